@@ -17,28 +17,244 @@ operations separately from the application. */
 #ifndef BACKEND_H_
 #define BACKEND_H_
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "foggy_pool.h"
 #include "foggy_tcp.h"
+#include "foggy_uring.h"
+
+// Number of event loop threads (shards) shared by all the sockets of the
+// process. Set with `foggy_setsockopt(NULL, FOGGY_OPT_BACKEND_THREADS, n)`.
+#define BACKEND_DEFAULT_THREADS 1
+#define BACKEND_MAX_THREADS 64
+
+// Maximum number of datagrams read by a single recvmmsg().
+#define BACKEND_RECV_BATCH 64
+
+// Maximum number of datagrams written by a single sendmmsg().
+#define BACKEND_SEND_BATCH 64
+// Largest number of iovecs of one queued packet: its header and a payload
+// that wraps around the end of the send ring.
+#define BACKEND_PKT_IOVS 3
+
+// Size of a receive buffer: one UDP datagram, possibly coalesced by GRO.
+#define BACKEND_RECV_BUF_SIZE 65536
+
+// Limits of a UDP GSO send: segments per message, and bytes per message
+// (the payload of one IPv4 UDP datagram).
+#define BACKEND_GSO_MAX_SEGMENTS 64
+#define BACKEND_GSO_MAX_BYTES 65507
+
+// MSG_ZEROCOPY: smaller messages are not worth pinning pages for, they are
+// copied as usual. A zero-copy message takes one page fragment per page of
+// each of its iovecs, and the kernel refuses more than MAX_SKB_FRAGS (17).
+// The headers of zero-copy messages are copied to slots that the kernel may
+// read until the send completes.
+#define ZEROCOPY_MIN_BYTES 4096
+#define ZEROCOPY_MAX_FRAGS 17
+#define ZEROCOPY_PAGE_SIZE 4096
+#define ZEROCOPY_HDR_SLOTS 512
+#define ZEROCOPY_HDR_SIZE 128
+
+// Room for the UDP_SEGMENT / UDP_GRO control message.
+#define BACKEND_CMSG_SIZE 64
+
+// io_uring engine: ring size, number of provided receive buffers, and
+// SENDMSG entries in flight per shard.
+#define URING_ENTRIES 256
+#define URING_BUF_COUNT 64
+#define URING_SEND_SLOTS 64
+
+// The low bits of an io_uring user_data tell what completed. Receives carry
+// the (aligned) socket pointer, sends their (aligned) uring_send_t.
+#define URING_TAG_RECV 0
+#define URING_TAG_SEND 1
+#define URING_TAG_CANCEL 2
+#define URING_TAG_MASK 3
+
+/**
+ * A SENDMSG entry of the io_uring engine, from submission to completion. The
+ * kernel may read the message until then, while the transmit batch is reused
+ * at once and the headers of the send window are rewritten: the entry keeps
+ * its own copy of the message, its iovecs and the headers, and the packets of
+ * the pool. The payload stays in the send ring, held by `pending`.
+ */
+typedef struct uring_send_t {
+    struct msghdr msg;
+    struct sockaddr_in addr;
+    char ctrl[BACKEND_CMSG_SIZE];
+    struct iovec iovs[BACKEND_SEND_BATCH * BACKEND_PKT_IOVS];
+    uint8_t hdrs[BACKEND_SEND_BATCH][SWND_HDR_SIZE];
+    uint8_t* owned[BACKEND_SEND_BATCH];  // Back to the pool on completion.
+    int owned_count;
+    foggy_socket_t* sock;
+    zc_send_t* pending;  // Entry of sock->zc_pending, NULL without payload.
+    struct uring_send_t* next_free;
+} uring_send_t;
 
 /**
- * Launches the CMU-TCP backend.
+ * One event loop of the backend engine. It owns a set of sockets and is the
+ * only thread that touches their protocol state.
+ */
+typedef struct backend_shard_t {
+    pthread_t thread_id;
+    int epoll_fd;   // Waits on the UDP sockets, timer_fd and event_fd.
+    int timer_fd;   // Armed to the earliest deadline in `timers`.
+    int event_fd;   // Kicked when `mailbox` stops being empty.
+
+    pkt_pool_t pool;  // Every packet of the shard's sockets comes from here.
+
+    // Sockets the application woke up: a lock-free stack linked through
+    // `mailbox_next`, pushed by any thread and emptied by the shard at once.
+    foggy_socket_t* mailbox;
+
+    vector<foggy_socket_t*> connections;  // Connection table of the shard.
+    vector<foggy_socket_t*> timers;       // Min-heap on timer_deadline.
+    vector<foggy_socket_t*> active;       // Sockets to process this round.
+
+    // Preallocated receive batch, reused by every check_for_pkt().
+    struct mmsghdr recv_msgs[BACKEND_RECV_BATCH];
+    struct iovec recv_iovs[BACKEND_RECV_BATCH];
+    struct sockaddr_in recv_addrs[BACKEND_RECV_BATCH];
+    char recv_ctrl[BACKEND_RECV_BATCH][BACKEND_CMSG_SIZE];
+    uint8_t* recv_bufs;  // BACKEND_RECV_BATCH * BACKEND_RECV_BUF_SIZE bytes.
+
+    // Transmit batch of `send_sock`, flushed by flush_pkts(). Packet i is
+    // made of send_iovs[send_iov_first[i]] up to send_iov_first[i + 1].
+    foggy_socket_t* send_sock;
+    int send_count;
+    struct iovec send_iovs[BACKEND_SEND_BATCH * BACKEND_PKT_IOVS];
+    int send_iov_first[BACKEND_SEND_BATCH + 1];
+    uint32_t send_len[BACKEND_SEND_BATCH];     // Length of each datagram.
+    uint8_t* send_owned[BACKEND_SEND_BATCH];   // Back to the pool once sent.
+
+    // Messages actually passed to sendmmsg(): one per packet, or one per run
+    // of packets when UDP GSO is enabled.
+    struct mmsghdr gso_msgs[BACKEND_SEND_BATCH];
+    char gso_ctrl[BACKEND_SEND_BATCH][BACKEND_CMSG_SIZE];
+    int gso_first[BACKEND_SEND_BATCH];    // First packet of each message.
+
+    // io_uring engine, set up when the first socket of the shard uses it.
+    uring_t uring;
+    int uring_state;               // 0 not tried, 1 usable, -1 unsupported.
+    struct msghdr uring_recv_hdr;  // Template of the multishot receives.
+    uring_send_t* uring_send_slots;   // URING_SEND_SLOTS entries.
+    uring_send_t* uring_free_sends;   // Those not in flight.
+} backend_shard_t;
+
+/**
+ * Runs the event loop of one backend shard.
  *
- * @param in the socket to be used for backend processing.
+ * @param in the shard (`backend_shard_t`) to run.
  */
 void* begin_backend(void* in);
 
+/**
+ * Hands a newly created socket to the backend engine, starting the engine on
+ * first use.
+ *
+ * @param sock The socket to be served by the backend.
+ */
+void backend_register(foggy_socket_t *sock);
+
+/**
+ * Sets the number of shards of the backend engine. Only allowed before the
+ * first socket is created.
+ *
+ * @param num_threads Number of event loop threads, 1 to BACKEND_MAX_THREADS.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int backend_set_num_threads(int num_threads);
+
 
 int has_been_acked(foggy_socket_t *sock, uint32_t seq);
 
 /**
  * Checks if the socket received any data.
  *
- * It first peeks at the header to figure out the length of the packet and
- * then reads the entire packet.
+ * Reads up to BACKEND_RECV_BATCH datagrams with a single recvmmsg() into the
+ * shard's preallocated buffers and processes them in arrival order. Must be
+ * called from the shard thread that owns the socket.
  *
  * @param sock The socket used for receiving data on the connection.
  * @param flags Flags that determine how the socket should wait for data.
  * Check `foggy_read_mode_t` for more information.
+ *
+ * @return The number of datagrams received, 0 if none was available.
+ */
+int check_for_pkt(foggy_socket_t *sock, foggy_read_mode_t flags);
+
+/**
+ * Queues a packet in the transmit batch of the socket's shard. The batch is
+ * handed to the kernel with a single sendmmsg() by `flush_pkts`, or earlier
+ * if it fills up or a packet of another socket is queued.
+ *
+ * @param sock The socket sending the packet.
+ * @param pkt The packet; it must stay valid until the batch is flushed.
+ * @param owned If non-zero, the batch gives the packet back to the shard's
+ *              pool after sending it.
+ */
+void queue_pkt(foggy_socket_t *sock, uint8_t *pkt, int owned);
+
+/**
+ * Same as `queue_pkt`, for a packet made of several pieces of memory (for
+ * example a header and a payload that sits in the send ring). The pieces are
+ * gathered by the kernel, so they are never copied.
+ *
+ * @param sock The socket sending the packet.
+ * @param iov The pieces of the packet; they must stay valid until the batch
+ *            is flushed. At most BACKEND_PKT_IOVS.
+ * @param iovcnt The number of pieces.
+ * @param owned A pool buffer to give back once the packet is sent, or NULL.
+ */
+void queue_pkt_iov(foggy_socket_t *sock, const struct iovec *iov, int iovcnt,
+                   uint8_t *owned);
+
+/**
+ * Consumes from the head of the send ring the bytes that were acknowledged
+ * and that no zero-copy send still references, and wakes the application if
+ * it waits for room in the ring.
+ *
+ * @param sock The socket.
+ */
+void release_send_ring(foggy_socket_t *sock);
+
+/**
+ * Sends every packet queued for the socket with `queue_pkt`.
+ *
+ * @param sock The socket whose pending packets are sent.
+ */
+void flush_pkts(foggy_socket_t *sock);
+
+/**
+ * Enables or disables UDP segmentation offload (GSO on send, GRO on receive)
+ * on the socket. Whatever the kernel does not support stays disabled, and
+ * the backend then uses one datagram per packet. Called by foggy_socket(),
+ * before the backend owns the socket.
+ *
+ * @param sock The socket to configure.
+ * @param enable Non-zero to enable the offloads.
+ */
+void set_udp_offload(foggy_socket_t *sock, int enable);
+
+/**
+ * Enables or disables MSG_ZEROCOPY for the large messages of the socket.
+ * Stays disabled if the kernel does not support it. Called by foggy_socket(),
+ * before the backend owns the socket.
+ *
+ * @param sock The socket to configure.
+ * @param enable Non-zero to enable zero-copy sends.
+ */
+void set_zerocopy(foggy_socket_t *sock, int enable);
+
+/**
+ * Wakes up the backend of a socket after the application queued work for it.
+ *
+ * @param sock The socket whose backend should be woken up.
  */
-void check_for_pkt(foggy_socket_t *sock, foggy_read_mode_t flags);
+void notify_backend(foggy_socket_t *sock);
 
 #endif  // BACKEND_H_
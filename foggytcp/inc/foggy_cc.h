@@ -0,0 +1,130 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/* This file defines the interface of the congestion control algorithms, and
+their registry. An algorithm is a table of hooks, found by name; each socket
+runs one of them, which keeps its state in the `cc_priv` area of the socket.
+
+Loss detection and recovery stay in the protocol (foggy_function.cc): it
+tells the algorithm when data is acknowledged, when a loss starts a fast
+recovery and when the retransmission timer fires, and asks it how much may
+be in flight and how fast to send. Model-based algorithms also get the
+delivery rate sample of each ACK (foggy_swnd.h). The algorithm owns
+`congestion_window` and `ssthresh` of the window. The protocol sets
+`reno_state` to RENO_FAST_RECOVERY for the whole of a recovery,
+RENO_CONGESTION_AVOIDANCE after it, and RENO_SLOW_START on a timeout;
+otherwise the algorithm may keep it. */
+
+#ifndef FOGGY_CC_H_
+#define FOGGY_CC_H_
+
+#include <stdint.h>
+
+#include "foggy_swnd.h"
+
+struct foggy_socket_t;
+
+// Longest name of an algorithm, terminator included.
+#define CC_NAME_MAX 16
+// Most algorithms the registry holds.
+#define CC_MAX_ALGORITHMS 16
+// Room for the state of an algorithm in each socket, in 64-bit words.
+#define CC_PRIV_WORDS 16
+// Algorithm of the new sockets, unless foggy_set_congestion_control() picks
+// another.
+#define CC_DEFAULT "reno"
+
+typedef struct {
+    char name[CC_NAME_MAX];
+
+    // Sets up the algorithm on a socket: when it is created, or when it
+    // switches to this algorithm; `cc_priv` is zeroed before. Optional.
+    void (*init)(struct foggy_socket_t* sock);
+
+    // An ACK acknowledged `acked` new bytes, or, with `acked` 0, is a
+    // duplicate that tells a segment left the network without SACKing it.
+    // `rtt` is the RTT sample it gave in ns, or -1. During a fast recovery,
+    // this is called before the protocol leaves it on the full ACK. Optional
+    // if the algorithm has cong_control.
+    void (*on_ack)(struct foggy_socket_t* sock, uint32_t acked, int64_t rtt);
+
+    // A loss starts a fast recovery. The window should be reduced.
+    void (*on_loss)(struct foggy_socket_t* sock);
+
+    // The retransmission timer fired with data in flight.
+    void (*on_rto)(struct foggy_socket_t* sock);
+
+    // A segment of `bytes` payload bytes is (re)transmitted. Optional.
+    void (*on_send)(struct foggy_socket_t* sock, uint32_t bytes);
+
+    // Returns the congestion window in bytes.
+    uint32_t (*cwnd)(struct foggy_socket_t* sock);
+
+    // Returns the rate to pace segments at in bytes per second, 0 to send
+    // them as fast as the window allows. Optional.
+    uint64_t (*pacing_rate)(struct foggy_socket_t* sock);
+
+    // An ACK delivered data (acknowledged or SACKed it); `rs` is its delivery
+    // rate sample. Called after the other hooks for the ACK, and after the
+    // protocol updated `reno_state`. Optional.
+    void (*cong_control)(struct foggy_socket_t* sock,
+                         const swnd_rate_sample_t* rs);
+} cc_ops_t;
+
+/**
+ * Adds an algorithm to the registry. The built-in ones are always there.
+ *
+ * @param ops The hooks of the algorithm, which must outlive every socket.
+ *
+ * @return 0 on success, -1 if its name is taken or the registry is full.
+ */
+int cc_register(const cc_ops_t* ops);
+
+/**
+ * Finds an algorithm by name.
+ *
+ * @return Its hooks, or NULL if no algorithm has that name.
+ */
+const cc_ops_t* cc_find(const char* name);
+
+/**
+ * Makes `ops` the algorithm of a socket, and initializes its state. Called
+ * by the thread that owns the socket.
+ */
+void cc_init(struct foggy_socket_t* sock, const cc_ops_t* ops);
+
+/* Calls the hooks of the algorithm of a socket, skipping the optional ones
+ * it lacks. */
+void cc_on_ack(struct foggy_socket_t* sock, uint32_t acked, int64_t rtt);
+void cc_on_loss(struct foggy_socket_t* sock);
+void cc_on_rto(struct foggy_socket_t* sock);
+void cc_on_send(struct foggy_socket_t* sock, uint32_t bytes);
+uint32_t cc_cwnd(struct foggy_socket_t* sock);
+uint64_t cc_pacing_rate(struct foggy_socket_t* sock);
+void cc_cong_control(struct foggy_socket_t* sock, const swnd_rate_sample_t* rs);
+
+/**
+ * Shapes the window during a fast recovery as NewReno does, for the
+ * algorithms that reduce it the same way: inflation and deflation without
+ * SACK, `ssthresh` on the full ACK.
+ *
+ * @param sock The socket.
+ * @param acked The `acked` argument of on_ack.
+ *
+ * @return 1 if the socket is in recovery and the ACK was handled, 0 if the
+ *         algorithm should grow its window.
+ */
+int cc_recovery_on_ack(struct foggy_socket_t* sock, uint32_t acked);
+
+// Built-in algorithms.
+extern const cc_ops_t cc_reno;
+extern const cc_ops_t cc_cubic;
+extern const cc_ops_t cc_bbr;
+
+#endif  // FOGGY_CC_H_
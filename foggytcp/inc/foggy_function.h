@@ -22,15 +22,33 @@ void on_recv_pkt(foggy_socket_t* sock, uint8_t* pkt);
 
 
 /**
- * Breaks up the data into packets and sends a single packet at a time.
+ * Breaks up the next bytes of the send ring into segments of the send window
+ * and sends those the window allows. The payload is not copied: segments
+ * point into the send ring until they are acknowledged.
  *
  * You should most certainly update this function in your implementation.
  *
  * @param sock The socket to use for sending data.
- * @param data The data to be sent.
- * @param buf_len The length of the data being sent.
+ * @param buf_len The number of bytes to segment, following the bytes already
+ *                segmented.
  */
-void send_pkts(foggy_socket_t* sock, uint8_t* data, int buf_len);
+void send_pkts(foggy_socket_t* sock, int buf_len);
+
+/**
+ * Sends an ACK for the data received in order so far, advertising the
+ * current receive window.
+ *
+ * @param sock The socket to acknowledge on.
+ */
+void send_ack(foggy_socket_t* sock);
+
+/**
+ * Sends the SYN of an initiator, or the SYN-ACK of a listener, with the
+ * options the socket offers, and starts the retransmission timer.
+ *
+ * @param sock The socket opening the connection.
+ */
+void send_syn(foggy_socket_t* sock);
 
 /*<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<*/
 
@@ -40,6 +58,29 @@ void process_receive_window(foggy_socket_t* sock);
 
 void transmit_send_window(foggy_socket_t* sock);
 
+/**
+ * Returns the window to advertise in outgoing packets, taken from the free
+ * space of the receive buffer and scaled down by the negotiated shift.
+ *
+ * @param sock The socket.
+ */
+uint16_t get_receive_window(foggy_socket_t* sock);
+
+/**
+ * Returns the size of the send window, limited by the peer's advertised
+ * window.
+ *
+ * @param sock The socket.
+ */
+uint32_t get_send_window(foggy_socket_t* sock);
+
+/**
+ * Returns how many new bytes the send window can take before it is full.
+ *
+ * @param sock The socket.
+ */
+uint32_t send_window_room(foggy_socket_t* sock);
+
 void receive_send_window(foggy_socket_t* sock);
 
 // Ajoutez ceci APRES le bloc des dclarations de fonctions existantes
@@ -47,6 +88,13 @@ void receive_send_window(foggy_socket_t* sock);
 // Constantes pour la Fentre Glissante
 #define WINDOW_SIZE_DEFAULT 10      // Taille initiale de la fentre en nombre de segments
 #define RTO_INITIAL 500             // Retransmission Timeout initial en ms (par exemple 500 ms)
+#define RTO_MIN 20                  // Borne basse du RTO en ms
+#define RTO_MAX 60000               // Borne haute du RTO en ms, backoff compris (RFC 6298)
+#define RTO_GRANULARITY 1000000     // Granularit G de l'horloge du timer en ns (RFC 6298)
+#define DUP_ACK_THRESHOLD 3         // Segments SACKs au-dessus d'un trou pour le dclarer perdu (RFC 6675)
+#define TS_RECENT_MAX_AGE (1800LL * 1000000000) // ts_recent prim aprs ce silence (ns), avant que l'horloge en s du pair ne tourne de 2^31
+#define PACING_BURST_NS 1000000     // Pacing : dure d'une rafale au dbit cible en ns (un rveil du timer par rafale)
+#define PACING_MIN_BURST (2 * MSS)  // Pacing : plus petite rafale en octets
 
 // Macros pour la comparaison de numros de squence (essentiel pour l'enroulement)
 #define SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
@@ -57,6 +105,7 @@ void receive_send_window(foggy_socket_t* sock);
 
 // Dclarations des fonctions de gestion du Timer (utilises par foggy_function.cc)
 // Ces fonctions doivent tre implmentes dans foggy_backend.cc, mais dclares ici.
+int64_t get_time_in_ns();
 void start_retransmit_timer(foggy_socket_t* sock);
 void stop_retransmit_timer(foggy_socket_t* sock);
 void on_retransmit_timer(foggy_socket_t* sock);
\ No newline at end of file
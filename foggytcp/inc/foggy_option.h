@@ -0,0 +1,125 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/* This file defines the options carried in the header extension. The
+extension is a list of options, each made of a kind byte, a length byte (of
+the whole option) and a value, with multi-byte fields in network order, as in
+TCP. Unknown options are skipped. */
+
+#ifndef FOGGY_OPTION_H_
+#define FOGGY_OPTION_H_
+
+#include <stdint.h>
+
+// Option kinds.
+#define OPT_KIND_WSCALE 3
+#define OPT_KIND_SACK 5
+#define OPT_KIND_TIMESTAMP 8
+
+// Room a timestamp option takes: TSval and TSecr (RFC 7323).
+#define OPT_TIMESTAMP_SIZE (2 + 4 + 4)
+
+// Room a window scale option takes: the shift count (RFC 7323).
+#define OPT_WSCALE_SIZE (2 + 1)
+// Largest shift count: windows stay below 2^30, as do sequence distances.
+#define OPT_WSCALE_MAX 14
+
+// Most blocks carried by a SACK option.
+#define OPT_SACK_MAX_BLOCKS 4
+// Room a SACK option of OPT_SACK_MAX_BLOCKS blocks takes.
+#define OPT_SACK_MAX_SIZE (2 + 8 * OPT_SACK_MAX_BLOCKS)
+
+// A run of bytes the receiver holds beyond its cumulative acknowledgement.
+typedef struct {
+    uint32_t start;  // First byte of the run.
+    uint32_t end;    // One past its last byte.
+} sack_block_t;
+
+/**
+ * Finds an option in a header extension.
+ *
+ * @param ext The extension.
+ * @param ext_len The length of the extension.
+ * @param kind The kind of the option.
+ * @param len Set to the length of the option value.
+ *
+ * @return The value of the first option of that kind, or NULL if there is
+ *         none or the extension is malformed.
+ */
+const uint8_t* opt_find(const uint8_t* ext, uint16_t ext_len, uint8_t kind,
+    uint8_t* len);
+
+/**
+ * Writes a SACK option.
+ *
+ * @param ext Where to write the option, with room for OPT_SACK_MAX_SIZE bytes.
+ * @param blocks The blocks to report, the most important first.
+ * @param count The number of blocks; at most OPT_SACK_MAX_BLOCKS are written.
+ *
+ * @return The number of bytes written, 0 if there is no block.
+ */
+uint16_t opt_put_sack(uint8_t* ext, const sack_block_t* blocks, int count);
+
+/**
+ * Reads the SACK option of a header extension.
+ *
+ * @param ext The extension.
+ * @param ext_len The length of the extension.
+ * @param blocks Filled with up to OPT_SACK_MAX_BLOCKS blocks.
+ *
+ * @return The number of blocks read, 0 if there is no SACK option.
+ */
+int opt_get_sack(const uint8_t* ext, uint16_t ext_len, sack_block_t* blocks);
+
+/**
+ * Writes a timestamp option.
+ *
+ * @param ext Where to write the option, with room for OPT_TIMESTAMP_SIZE bytes.
+ * @param tsval The clock of the sender.
+ * @param tsecr The TSval of the peer being echoed.
+ *
+ * @return The number of bytes written.
+ */
+uint16_t opt_put_timestamp(uint8_t* ext, uint32_t tsval, uint32_t tsecr);
+
+/**
+ * Reads the timestamp option of a header extension.
+ *
+ * @param ext The extension.
+ * @param ext_len The length of the extension.
+ * @param tsval Set to the clock of the sender.
+ * @param tsecr Set to the TSval it echoes.
+ *
+ * @return 1 if the extension holds a timestamp option, 0 otherwise.
+ */
+int opt_get_timestamp(const uint8_t* ext, uint16_t ext_len, uint32_t* tsval,
+    uint32_t* tsecr);
+
+/**
+ * Writes a window scale option.
+ *
+ * @param ext Where to write the option, with room for OPT_WSCALE_SIZE bytes.
+ * @param shift The shift count of the windows the sender advertises.
+ *
+ * @return The number of bytes written.
+ */
+uint16_t opt_put_wscale(uint8_t* ext, uint8_t shift);
+
+/**
+ * Reads the window scale option of a header extension.
+ *
+ * @param ext The extension.
+ * @param ext_len The length of the extension.
+ * @param shift Set to the shift count, at most OPT_WSCALE_MAX.
+ *
+ * @return 1 if the extension holds a window scale option, 0 otherwise.
+ */
+int opt_get_wscale(const uint8_t* ext, uint16_t ext_len, uint8_t* shift);
+
+#endif  // FOGGY_OPTION_H_
@@ -41,7 +41,9 @@ typedef struct {
 
 // Maximum Segment Size. Make sure to update this if your CCA requires extension
 // data for all packets, as this reduces the payload and thus the MSS.
-#define MSS (MAX_LEN - sizeof(foggy_tcp_header_t))
+// Data segments carry the timestamp option once it is negotiated: 10 bytes,
+// OPT_TIMESTAMP_SIZE of foggy_option.h.
+#define MSS (MAX_LEN - sizeof(foggy_tcp_header_t) - 10)
 
 /* Helper functions to get/set fields in the header */
 
@@ -0,0 +1,73 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/* This file defines the packet buffer pool of the backend. Every backend
+thread owns one pool and allocates all its packets from it, so the pool
+needs no lock. */
+
+#ifndef FOGGY_POOL_H_
+#define FOGGY_POOL_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "foggy_packet.h"
+#include "grading.h"
+
+using namespace std;
+
+#define POOL_ALIGN 64
+// One buffer holds a full packet, rounded up to whole cache lines.
+#define POOL_BUF_SIZE ((MAX_LEN + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN)
+// Buffers added each time the pool runs dry.
+#define POOL_SLAB_COUNT 256
+
+typedef struct {
+    uint8_t* free_list;       // Free buffers, linked through their first bytes.
+    uint32_t free_count;
+    uint32_t total_count;
+    vector<uint8_t*> slabs;   // Memory of the buffers, released on destroy.
+} pkt_pool_t;
+
+/**
+ * Initializes an empty pool. Memory is allocated on the first `pool_get`.
+ */
+void pool_init(pkt_pool_t* pool);
+
+/**
+ * Releases all the memory of the pool, including buffers still in use.
+ */
+void pool_destroy(pkt_pool_t* pool);
+
+/**
+ * Takes a POOL_BUF_SIZE bytes buffer, aligned on a cache line.
+ *
+ * @return The buffer, or NULL if memory is short.
+ */
+uint8_t* pool_get(pkt_pool_t* pool);
+
+/**
+ * Gives a buffer obtained from `pool_get` back to the pool.
+ */
+void pool_put(pkt_pool_t* pool, uint8_t* buf);
+
+/**
+ * Same as `create_packet`, but builds the packet in a buffer of the pool.
+ * The packet must be released with `pool_put`.
+ *
+ * @return The packet, or NULL if the arguments are invalid, the packet does
+ *         not fit in POOL_BUF_SIZE bytes, or memory is short.
+ */
+uint8_t* pool_create_packet(pkt_pool_t* pool, uint16_t src, uint16_t dst,
+    uint32_t seq, uint32_t ack, uint16_t hlen, uint16_t plen, uint8_t flags,
+    uint16_t adv_window, uint16_t ext_len, uint8_t* ext_data, uint8_t* payload,
+    uint16_t payload_len);
+
+#endif  // FOGGY_POOL_H_
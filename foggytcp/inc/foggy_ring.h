@@ -0,0 +1,140 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/* This file defines the fixed-capacity byte ring used to pass data between
+the application and the backend threads. One thread writes and one thread
+reads; neither of them takes a lock. A side that finds the ring empty (or
+full) may sleep on a futex until the other side makes progress; the other
+side only makes a system call to wake it if it is actually asleep. */
+
+#ifndef FOGGY_RING_H_
+#define FOGGY_RING_H_
+
+#include <stdint.h>
+
+// Largest capacity a ring can be created with.
+#define RING_MAX_CAPACITY (1u << 30)
+
+typedef struct {
+    uint8_t* data;
+    uint32_t capacity;  // A power of two.
+    uint32_t mask;      // capacity - 1.
+    uint32_t head;      // Bytes ever read. Only the reader stores it.
+    uint32_t tail;      // Bytes ever written. Only the writer stores it.
+    uint32_t reader_waiting;  // The reader sleeps on `tail`.
+    uint32_t writer_waiting;  // The writer sleeps on `head`.
+} byte_ring_t;
+
+/**
+ * Allocates the storage of a ring.
+ *
+ * @param ring The ring to initialize.
+ * @param capacity The requested capacity in bytes, rounded up to a power of
+ *                 two.
+ *
+ * @return 0 on success, -1 if the capacity is invalid or memory is short.
+ */
+int ring_init(byte_ring_t* ring, uint32_t capacity);
+
+/**
+ * Releases the storage of a ring.
+ */
+void ring_destroy(byte_ring_t* ring);
+
+/**
+ * Returns the number of bytes waiting to be read.
+ */
+uint32_t ring_used(const byte_ring_t* ring);
+
+/**
+ * Returns the number of bytes that can be written without overwriting unread
+ * data.
+ */
+uint32_t ring_space(const byte_ring_t* ring);
+
+/**
+ * Writer side: copies as much of `len` bytes as fits into the ring.
+ *
+ * @return The number of bytes copied.
+ */
+uint32_t ring_write(byte_ring_t* ring, const uint8_t* data, uint32_t len);
+
+/**
+ * Writer side: copies as much of `len` bytes as fits into the free room of
+ * the ring, `offset` bytes after its end, without making them readable. This
+ * lets the writer fill the room out of order.
+ *
+ * @return The number of bytes copied.
+ */
+uint32_t ring_write_at(byte_ring_t* ring, uint32_t offset, const uint8_t* data,
+    uint32_t len);
+
+/**
+ * Writer side: makes readable the next `len` bytes of the free room, which
+ * were filled with `ring_write_at`.
+ */
+void ring_commit(byte_ring_t* ring, uint32_t len);
+
+/**
+ * Reader side: copies up to `len` bytes out of the ring and consumes them.
+ *
+ * @return The number of bytes copied.
+ */
+uint32_t ring_read(byte_ring_t* ring, uint8_t* data, uint32_t len);
+
+/**
+ * Reader side: points `data` at the unread bytes that start `offset` bytes
+ * after the oldest one, without consuming them. The bytes are contiguous, so
+ * fewer than available may be returned when the data wraps around the end of
+ * the storage.
+ *
+ * @return The number of contiguous bytes available at `*data`.
+ */
+uint32_t ring_peek(const byte_ring_t* ring, uint32_t offset, uint8_t** data);
+
+/**
+ * Reader side: consumes `len` bytes, making their room available to the
+ * writer.
+ */
+void ring_consume(byte_ring_t* ring, uint32_t len);
+
+/**
+ * Reader side: blocks until the ring holds data.
+ */
+void ring_wait_data(byte_ring_t* ring);
+
+/**
+ * Writer side: blocks until the ring has room.
+ */
+void ring_wait_space(byte_ring_t* ring);
+
+/**
+ * Writer side: wakes the reader if it sleeps in `ring_wait_data`. Call it
+ * after writing; once per batch of writes is enough.
+ */
+void ring_wake_reader(byte_ring_t* ring);
+
+/**
+ * Reader side: wakes the writer if it sleeps in `ring_wait_space`. Call it
+ * after consuming; once per batch is enough.
+ */
+void ring_wake_writer(byte_ring_t* ring);
+
+/**
+ * Sleeps until `*addr` is woken with `futex_wake`, unless it no longer holds
+ * `val`. May return spuriously, so callers check their condition again.
+ */
+void futex_wait(uint32_t* addr, uint32_t val);
+
+/**
+ * Wakes every thread sleeping in `futex_wait` on `addr`.
+ */
+void futex_wake(uint32_t* addr);
+
+#endif  // FOGGY_RING_H_
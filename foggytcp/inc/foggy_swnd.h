@@ -0,0 +1,250 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/* This file defines the send window: the ring of the segments sent, or about
+to be sent, and not acknowledged yet. Slots only hold compact metadata; the
+payload stays in the send ring of the socket.
+
+The window is also the SACK scoreboard of RFC 6675: segments are flagged as
+selectively acknowledged, lost or retransmitted, and the window keeps the byte
+counts of each flag, so that the data in flight (`pipe`) is known in O(1).
+
+Finally, it estimates the delivery rate (draft-cheng-iccrg-delivery-rate-
+estimation): each segment records how much had been delivered, and when,
+as it was sent; the ACK that delivers it divides what was delivered since by
+the time elapsed. */
+
+#ifndef FOGGY_SWND_H_
+#define FOGGY_SWND_H_
+
+#include <stdint.h>
+
+#include "foggy_option.h"
+#include "foggy_packet.h"
+
+// Slots of a new send window. It doubles whenever it is full.
+#define SWND_INITIAL_SLOTS 64
+// Room for the header of one segment, options included.
+#define SWND_HDR_SIZE (sizeof(foggy_tcp_header_t) + OPT_TIMESTAMP_SIZE)
+
+// send_window_slot_t flags.
+#define SWND_SENT 0x1     // Transmitted at least once.
+#define SWND_SACKED 0x2   // Selectively acknowledged by the peer.
+#define SWND_LOST 0x4     // Deemed lost, not SACKed since.
+#define SWND_RETRANS 0x8  // Retransmitted since it was deemed lost.
+#define SWND_APP_LIMITED 0x10  // Sent while the sender was application-limited.
+
+typedef struct {
+    int64_t send_time;    // CLOCK_MONOTONIC ns of the last transmission.
+    uint32_t seq;         // Sequence number of the first payload byte.
+    uint16_t len;         // Payload length.
+    uint8_t flags;        // SWND_SENT, SWND_SACKED, SWND_LOST, SWND_RETRANS,
+                          // SWND_APP_LIMITED.
+    uint8_t retransmits;  // Transmissions after the first one.
+    // State of the window at the last transmission, for the rate sample.
+    uint64_t delivered;
+    int64_t delivered_time;
+    int64_t first_sent_time;
+} send_window_slot_t;
+
+/**
+ * The delivery rate sample of an ACK.
+ */
+typedef struct {
+    uint64_t delivered;        // Bytes delivered over `interval`.
+    int64_t interval;          // In ns; 0 if the ACK gives no sample.
+    uint64_t prior_delivered;  // Bytes delivered when the newest segment
+                               // the ACK delivers was sent.
+    uint32_t newly_delivered;  // Bytes the ACK acknowledged or SACKed.
+    int is_app_limited;        // That segment was sent application-limited:
+                               // the rate may be below what the path allows.
+    int64_t rtt;               // RTT sample of the ACK in ns, or -1. Set by
+                               // the protocol, not by swnd_rate_sample().
+} swnd_rate_sample_t;
+
+typedef struct {
+    send_window_slot_t* slots;
+    // Header of the last transmission of each slot, kept apart so that
+    // walking the metadata stays dense. The transmit batch points into it.
+    uint8_t (*hdrs)[SWND_HDR_SIZE];
+    uint32_t capacity;   // A power of two.
+    uint32_t mask;       // capacity - 1.
+    uint32_t head;       // Slots ever popped: the oldest unacknowledged one.
+    uint32_t tail;       // Slots ever pushed.
+    uint32_t next_send;  // First slot never sent.
+
+    // Scoreboard. The hints are slot counters like `head`.
+    uint32_t sacked_bytes;   // Bytes of SWND_SACKED slots.
+    uint32_t lost_bytes;     // Bytes of SWND_LOST slots.
+    uint32_t retrans_bytes;  // Bytes of SWND_RETRANS slots.
+    uint32_t high_sacked;    // One past the highest SWND_SACKED slot.
+    uint32_t lost_hint;      // Slots before it were checked by swnd_mark_lost.
+    uint32_t retrans_hint;   // No slot before it is lost and unretransmitted.
+
+    // Delivery rate. Times are CLOCK_MONOTONIC ns.
+    uint64_t delivered;        // Bytes ever acknowledged or SACKed.
+    int64_t delivered_time;    // When `delivered` last grew.
+    int64_t first_sent_time;   // Send time of the newest segment delivered.
+    uint64_t app_limited;      // Application-limited until `delivered` passes
+                               // it; 0 if not.
+    // The sample of the ACK being processed.
+    int64_t rs_now;
+    int64_t rs_send_time;      // Send time of the newest segment delivered.
+    int64_t rs_prior_time;
+    int64_t rs_send_elapsed;
+    int64_t rs_ack_elapsed;
+    uint64_t rs_prior_delivered;
+    uint32_t rs_newly;
+    int rs_app_limited;
+} send_window_ring_t;
+
+/**
+ * Allocates an empty send window of SWND_INITIAL_SLOTS slots.
+ *
+ * @return 0 on success, -1 if memory is short.
+ */
+int swnd_init(send_window_ring_t* swnd);
+
+/**
+ * Releases the memory of a send window.
+ */
+void swnd_destroy(send_window_ring_t* swnd);
+
+/**
+ * Returns the number of segments in the window.
+ */
+uint32_t swnd_count(const send_window_ring_t* swnd);
+
+/**
+ * Returns non-zero if the window holds no segment.
+ */
+int swnd_empty(const send_window_ring_t* swnd);
+
+/**
+ * Returns the `i`-th oldest segment of the window (0 is the oldest).
+ */
+send_window_slot_t* swnd_at(const send_window_ring_t* swnd, uint32_t i);
+
+/**
+ * Returns the oldest segment of the window, which must not be empty.
+ */
+send_window_slot_t* swnd_front(const send_window_ring_t* swnd);
+
+/**
+ * Returns the header storage of a slot of the window.
+ */
+uint8_t* swnd_hdr(const send_window_ring_t* swnd, const send_window_slot_t* slot);
+
+/**
+ * Appends a segment to the window. Headers and slots move when the window
+ * grows, so nothing may point to them (e.g. a transmit batch not flushed
+ * yet) when `swnd_full` is true.
+ *
+ * @return The new slot, or NULL if memory is short.
+ */
+send_window_slot_t* swnd_push(send_window_ring_t* swnd, uint32_t seq,
+    uint16_t len);
+
+/**
+ * Returns non-zero if the next `swnd_push` has to grow the window.
+ */
+int swnd_full(const send_window_ring_t* swnd);
+
+/**
+ * Removes the oldest `n` segments of the window, which were cumulatively
+ * acknowledged.
+ */
+void swnd_pop(send_window_ring_t* swnd, uint32_t n);
+
+/**
+ * Records the transmission of a slot: a first transmission, or a
+ * retransmission, which is counted in flight again if the slot was lost.
+ *
+ * @param now The CLOCK_MONOTONIC time of the transmission in ns.
+ */
+void swnd_sent(send_window_ring_t* swnd, send_window_slot_t* slot, int64_t now);
+
+/**
+ * Flags a sent segment as lost, unless it is SACKed or was already
+ * retransmitted (a fast retransmission).
+ */
+void swnd_lose(send_window_ring_t* swnd, send_window_slot_t* slot);
+
+/**
+ * Flags as SACKed the segments that [start, end) covers entirely.
+ *
+ * @return The number of segments newly SACKed.
+ */
+uint32_t swnd_sack(send_window_ring_t* swnd, uint32_t start, uint32_t end,
+    uint16_t mss);
+
+/**
+ * Flags as lost the sent segments that have at least `dup_thresh` SACKed
+ * segments above them (IsLost() of RFC 6675), unless they were already
+ * retransmitted.
+ */
+void swnd_mark_lost(send_window_ring_t* swnd, uint32_t dup_thresh);
+
+/**
+ * After a retransmission timeout: flags as lost every sent segment that is not
+ * SACKed, retransmitted ones included.
+ */
+void swnd_mark_all_lost(send_window_ring_t* swnd);
+
+/**
+ * Returns the oldest lost segment not retransmitted yet, or NULL.
+ */
+send_window_slot_t* swnd_next_lost(send_window_ring_t* swnd);
+
+/**
+ * Returns the bytes sent and not cumulatively acknowledged (FlightSize of
+ * RFC 5681).
+ */
+uint32_t swnd_out(const send_window_ring_t* swnd);
+
+/**
+ * Returns the bytes in flight: sent and neither acknowledged, SACKed nor
+ * lost, plus those retransmitted (`pipe` of RFC 6675).
+ */
+uint32_t swnd_pipe(const send_window_ring_t* swnd);
+
+/**
+ * Starts the delivery rate sample of an ACK, before it is recorded with
+ * swnd_pop and swnd_sack.
+ *
+ * @param now The CLOCK_MONOTONIC time of the ACK in ns.
+ */
+void swnd_rate_begin(send_window_ring_t* swnd, int64_t now);
+
+/**
+ * Completes the delivery rate sample of an ACK.
+ *
+ * @param rs Filled with the sample, except `rtt`.
+ *
+ * @return The number of bytes the ACK delivered.
+ */
+uint32_t swnd_rate_sample(send_window_ring_t* swnd, swnd_rate_sample_t* rs);
+
+/**
+ * Marks the sender application-limited: the window has room, but nothing is
+ * left to send. The samples of the data in flight then tell what the
+ * application offered, not what the path can carry.
+ */
+void swnd_app_limited(send_window_ring_t* swnd);
+
+/**
+ * Returns the position in the window (0 is the oldest) of the segment that
+ * holds sequence number `seq`. O(1) when the segments are full-sized, which
+ * is the case of bulk transfers, and a binary search otherwise.
+ *
+ * @return The position, or swnd_count() if no segment holds `seq`.
+ */
+uint32_t swnd_find(const send_window_ring_t* swnd, uint32_t seq, uint16_t mss);
+
+#endif  // FOGGY_SWND_H_
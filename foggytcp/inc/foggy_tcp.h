@@ -21,7 +21,10 @@ from releasing their forks in any public places. */
 #include <time.h>
 #include <deque>
 
+#include "foggy_cc.h"
 #include "foggy_packet.h"
+#include "foggy_ring.h"
+#include "foggy_swnd.h"
 #include "grading.h"
 
 using namespace std;
@@ -39,27 +42,40 @@ typedef enum {
     RENO_FAST_RECOVERY = 2,
 } reno_state_t;
 
+// A run of bytes received ahead of next_seq_expected. The bytes already sit
+// in the free room of the receive ring, at their offset from its end.
 typedef struct {
-    int is_sent;
-    uint8_t* msg;
-
-    int is_rtt_sample;
-    struct timespec send_time;
-    time_t timeout_interval;
-} send_window_slot_t;
+    uint32_t seq;  // First byte of the run.
+    uint32_t end;  // One past its last byte.
+} receive_window_slot_t;
 
+// A message sent with MSG_ZEROCOPY, or through io_uring, that the kernel may
+// still read from.
 typedef struct {
-    uint8_t* msg;
-    int is_used;
-} receive_window_slot_t;
+    uint32_t id;         // Completion id the kernel gave the message.
+    uint32_t first_seq;  // Oldest sequence number of its payload.
+    uint32_t hdr_end;    // zc_hdr_tail once its headers were copied.
+    int done;
+} zc_send_t;
 
 /* >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> */
 
+struct backend_shard_t;
+
 typedef enum {
     TCP_INITIATOR = 0,
     TCP_LISTENER = 1,
 } foggy_socket_type_t;
 
+// Connection states. Options are negotiated on the SYN and SYN-ACK, and no
+// data is sent before the handshake completes.
+typedef enum {
+    TCP_SYN_SENT = 0,     // Initiator: SYN sent, waiting for the SYN-ACK.
+    TCP_LISTEN = 1,       // Listener: waiting for a SYN.
+    TCP_SYN_RCVD = 2,     // Listener: SYN-ACK sent, waiting for its ACK.
+    TCP_ESTABLISHED = 3,
+} foggy_tcp_state_t;
+
 typedef struct {
     uint32_t last_byte_sent;
     uint32_t last_ack_received;
@@ -72,7 +88,8 @@ typedef struct {
     uint32_t congestion_window;
 
     reno_state_t reno_state;
-    pthread_mutex_t ack_lock;
+    uint32_t recovery_point;     // NewReno "recover": next_seq_num when the last recovery began.
+    int sack_seen;               // The peer reports SACK blocks.
     uint32_t send_base;          // Numro de squence du plus ancien paquet non acquitt.
     uint32_t next_seq_num;       // Prochain numro de squence  utiliser pour un nouveau paquet.
     uint32_t effective_window_size; // Taille de la fentre (min(cwnd, advertised_window)).
@@ -80,6 +97,9 @@ typedef struct {
 
   // Timer de Retransmission (RTO)
     int32_t retransmit_timeout;  // Dlai d'attente avant retransmission (en ms).
+    int32_t rto;                 // RTO for the next timer in ms, backoff included.
+    int64_t srtt;                // Smoothed RTT in ns, 0 before the first sample.
+    int64_t rttvar;              // RTT variation in ns.
     struct timespec last_send_time; // L'heure (timestamp) o le paquet SendBase a t envoy.
 } window_t;
 
@@ -89,25 +109,67 @@ typedef struct {
  */
 struct foggy_socket_t {
     int socket;
-    // foggy_tcp_state_t state;
-    pthread_t thread_id;
+    foggy_tcp_state_t state;  // Owned by the backend.
     uint16_t my_port;
     struct sockaddr_in conn;
-    uint8_t* received_buf;
-    int received_len;
-    pthread_mutex_t recv_lock;
-    pthread_cond_t wait_cond;
-    uint8_t* sending_buf;
-    int sending_len;
+    byte_ring_t recv_ring;     // Written by the backend, read by foggy_read().
+    int window_update;         // foggy_read() reopened the receive window.
+    byte_ring_t send_ring;     // Written by foggy_write(), read by the backend.
+    uint32_t send_ring_seq;    // Sequence number of the send ring's head.
+    uint32_t send_pulled;      // Ring position up to which data is segmented.
+    int nonblocking;           // foggy_write() returns instead of waiting.
     foggy_socket_type_t type;
-    pthread_mutex_t send_lock;
-    int dying;
-    pthread_mutex_t death_lock;
+    int is_connected;  // Listener only: UDP socket connected to its peer.
+    int gso_enabled;   // Runs of segments are sent with UDP_SEGMENT.
+    int gro_enabled;   // The kernel may coalesce received segments (UDP_GRO).
+    int io_engine;     // foggy_io_engine_t used for the UDP socket.
+    int zc_enabled;    // Large messages are sent with MSG_ZEROCOPY.
+    uint32_t zc_next_id;         // Completion id of the next zero-copy send.
+    deque<zc_send_t> zc_pending; // Zero-copy or io_uring sends not completed yet.
+    uint8_t* zc_hdrs;  // Copies of their headers, ZEROCOPY_HDR_SLOTS slots.
+    uint32_t zc_hdr_head;        // Slots ever released.
+    uint32_t zc_hdr_tail;        // Slots ever used.
+    int uring_armed;   // io_uring: a multishot receive is posted.
+    deque<uint64_t> uring_pending;  // io_uring: received (buffer id, length).
+    int uring_sends;   // io_uring: SENDMSG entries in flight.
+    uint32_t dying;    // Set by foggy_close(), read by the backend.
+    uint32_t closed;   // Set once the backend released the socket; futex.
     window_t window;
 
+    // Backend engine bookkeeping, owned by the shard thread except `kicked`.
+    struct backend_shard_t* shard;
+    int kicked;         // Already queued in the shard mailbox.
+    foggy_socket_t* mailbox_next;  // Next socket of the shard mailbox.
+    int is_registered;  // Present in the shard's connection table.
+    int is_active;      // Queued for processing in the current loop round.
+    int conn_index;     // Position in the shard's connection table.
+    int64_t timer_deadline;  // CLOCK_MONOTONIC ns, 0 when no timer runs.
+    int timer_index;    // Position in the shard's timer heap, -1 if absent.
+
     /* <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< */
-    deque<send_window_slot_t> send_window;
+    send_window_ring_t send_window;
+    // Out-of-order runs, sorted by sequence number; they neither overlap nor
+    // touch each other.
     receive_window_slot_t receive_window[RECEIVE_WINDOW_SLOT_SIZE];
+    int receive_window_count;
+    uint32_t receive_window_recent;  // Start of the latest segment stored.
+    // Timestamp option (RFC 7323). Before the handshake, whether we offer it.
+    int ts_enabled;
+    uint32_t ts_recent;       // Peer's TSval to echo.
+    int64_t ts_recent_time;   // CLOCK_MONOTONIC ns when it was recorded.
+    // Window scale option (RFC 7323). Before the handshake, whether we offer
+    // it; the shift counts are 0 if either end does not.
+    int ws_enabled;
+    uint8_t rcv_wscale;  // Of the windows we advertise; read by foggy_read().
+    uint8_t snd_wscale;  // Of the windows the peer advertises.
+    // Congestion control algorithm and its state.
+    const cc_ops_t* cc;
+    const cc_ops_t* cc_request;  // Set by foggy_set_congestion_control().
+    uint64_t cc_priv[CC_PRIV_WORDS];
+    // Pacing. Owned by the backend, except `max_pacing_rate`.
+    uint32_t max_pacing_rate;  // FOGGY_OPT_PACING_RATE in bytes/s, 0 for none.
+    int64_t pacing_next;       // CLOCK_MONOTONIC ns when the next burst may leave.
+    int pacing_wait;           // Segments wait for pacing_next.
     /* >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> */
 };
 
@@ -174,7 +236,9 @@ int foggy_read(void* sock, void* buf, const int length);
  * @param buf The data to write.
  * @param length The number of bytes to write.
  *
- * @return 0 on success, -1 on error.
+ * @return The number of bytes queued on success, -1 on error. Blocks until all
+ *         of `length` is queued, unless the socket is non-blocking (check
+ *         `FOGGY_OPT_NONBLOCK`).
  */
 int foggy_write(void* sock, const void* buf, int length);
 
@@ -182,4 +246,131 @@ int foggy_write(void* sock, const void* buf, int length);
  * You can declare more functions after this point if you need to.
  */
 
+/**
+ * Reads data from a FoggyTCP socket without copying it: points `data` at the
+ * oldest received bytes, in the receive buffer of the socket. The bytes stay
+ * there, and keep taking room in the receive window, until they are released
+ * with `foggy_release`; calling this function again before that returns the
+ * same bytes.
+ *
+ * Blocks like `foggy_read` until data is available.
+ *
+ * @param sock The socket to read from.
+ * @param data Set to the first byte received.
+ * @param length The maximum number of bytes to return.
+ *
+ * @return The number of contiguous bytes at `*data` on success, -1 on error.
+ *         Fewer bytes than received may be returned when the data wraps
+ *         around the end of the receive buffer.
+ */
+int foggy_read_zc(void* sock, const void** data, int length);
+
+/**
+ * Releases bytes obtained with `foggy_read_zc`, oldest first, which makes
+ * room for new data in the receive window.
+ *
+ * @param sock The socket the bytes were read from.
+ * @param length The number of bytes to release.
+ *
+ * @return 0 on success, -1 if more bytes than received are released.
+ */
+int foggy_release(void* sock, int length);
+
+/**
+ * Options supported by `foggy_setsockopt`.
+ */
+typedef enum {
+    // Process-wide number of backend event loop threads. Connections are
+    // sharded over the threads; each connection is owned by exactly one of
+    // them. Must be set (with a NULL socket) before the first foggy_socket().
+    FOGGY_OPT_BACKEND_THREADS = 0,
+    // Non-zero to use UDP GSO/GRO segmentation offload for bulk transfers.
+    // Falls back to one datagram per segment if the kernel lacks support.
+    // The backend sends and receives with it, so it can only be set as a
+    // default (NULL socket).
+    FOGGY_OPT_UDP_OFFLOAD = 1,
+    // I/O engine (`foggy_io_engine_t`) of the backend. Picked when a socket
+    // is created, so it can only be set as a default (with a NULL socket).
+    FOGGY_OPT_IO_ENGINE = 2,
+    // Size in bytes of the send buffer, rounded up to a power of two. The
+    // backend reads it, so it can only be set as a default (NULL socket).
+    FOGGY_OPT_SNDBUF = 3,
+    // Non-zero for foggy_write() to queue what fits in the send buffer and
+    // return, instead of waiting for the backend to make room.
+    FOGGY_OPT_NONBLOCK = 4,
+    // Size in bytes of the receive buffer, rounded up to a power of two. The
+    // backend fills it, so it can only be set as a default (NULL socket).
+    FOGGY_OPT_RCVBUF = 5,
+    // Non-zero to send large messages (UDP GSO runs) with MSG_ZEROCOPY, so
+    // the kernel reads the payload from the send buffer instead of copying
+    // it. Only used by the FOGGY_IO_SYSCALL engine; stops by itself if the
+    // kernel reports that it had to copy anyway (e.g. on loopback). The
+    // backend sends with it, so it can only be set as a default (NULL
+    // socket).
+    FOGGY_OPT_ZEROCOPY = 6,
+    // Non-zero to offer the timestamp option, which gives an RTT sample per
+    // ACK and rejects old duplicate segments (PAWS). Used only if the peer
+    // offers it too. Negotiated at connection setup, so it can only be set as
+    // a default (NULL socket).
+    FOGGY_OPT_TIMESTAMPS = 7,
+    // Non-zero to offer the window scale option, without which a window is
+    // at most 64 KB. Used only if the peer offers it too. Negotiated at
+    // connection setup, so it can only be set as a default (NULL socket).
+    FOGGY_OPT_WINDOW_SCALE = 8,
+    // Most bytes per second to send at, spread evenly instead of in bursts
+    // as the window opens; 0 (the default) for no limit. The congestion
+    // control algorithm may pace the socket slower (e.g. BBR).
+    FOGGY_OPT_PACING_RATE = 9,
+    // Non-zero for the listeners created afterwards to share their port
+    // (SO_REUSEPORT): each new flow goes to one of those not connected yet.
+    // Without it, binding a port already in use fails. Can only be set as a
+    // default (NULL socket).
+    FOGGY_OPT_REUSEPORT = 10,
+} foggy_option_t;
+
+// Default size of the send buffer (FOGGY_OPT_SNDBUF). Unacknowledged data
+// stays in it, so it bounds the bytes in flight: 1 MB covers the
+// bandwidth-delay product of 100 Mbit/s over 40 ms (500 KB) with room to
+// spare.
+#define SNDBUF_DEFAULT (1024 * 1024)
+// Default size of the receive buffer (FOGGY_OPT_RCVBUF), which bounds the
+// window we advertise.
+#define RCVBUF_DEFAULT (1024 * 1024)
+
+/**
+ * I/O engines the backend can use to move datagrams.
+ */
+typedef enum {
+    FOGGY_IO_SYSCALL = 0,  // epoll + recvmmsg/sendmmsg.
+    FOGGY_IO_URING = 1,    // io_uring multishot receives and SENDMSG entries.
+                           // Falls back to FOGGY_IO_SYSCALL if unsupported.
+} foggy_io_engine_t;
+
+/**
+ * Sets an option on a FoggyTCP socket.
+ *
+ * @param sock The socket to configure, or NULL for process-wide options. For
+ *             per-socket options, NULL sets the default of the sockets
+ *             created afterwards.
+ * @param option The option to set. Check `foggy_option_t` for more
+ *               information.
+ * @param value The new value of the option.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_setsockopt(void* sock, foggy_option_t option, int value);
+
+/**
+ * Picks the congestion control algorithm of a FoggyTCP socket by name (see
+ * foggy_cc.h). The backend switches at its next round; the new algorithm
+ * starts from the current window.
+ *
+ * @param sock The socket, or NULL to set the default of the sockets created
+ *             afterwards (CC_DEFAULT at first).
+ * @param name The name of the algorithm.
+ *
+ * @return 0 on success, -1 if `name` is NULL or no algorithm has that name.
+ */
+int foggy_set_congestion_control(void* sock, const char* name);
+
 #endif  // FOGGY_TCP_H_
@@ -0,0 +1,110 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/* This file defines a minimal io_uring wrapper used by the io_uring I/O
+engine of the backend. It talks to the kernel with raw system calls, so no
+extra library is needed. */
+
+#ifndef FOGGY_URING_H_
+#define FOGGY_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The kernel UAPI header uses anonymous structs, which -pedantic rejects.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#include <linux/io_uring.h>
+#pragma GCC diagnostic pop
+
+typedef struct {
+    int ring_fd;
+
+    // Submission queue.
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_pending;   // SQEs filled but not yet submitted.
+    struct io_uring_sqe* sqes;
+
+    // Completion queue.
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // Provided buffer ring, used by multishot receives.
+    struct io_uring_buf_ring* buf_ring;
+    uint8_t* bufs;
+    unsigned buf_count;
+    unsigned buf_size;
+    uint16_t buf_tail;
+    uint16_t buf_group;
+
+    void* sq_ptr;
+    void* cq_ptr;
+    size_t sq_map_len;
+    size_t cq_map_len;
+} uring_t;
+
+/**
+ * Sets up an io_uring instance with a provided buffer ring.
+ *
+ * @param ring The ring to initialize.
+ * @param entries Number of submission queue entries.
+ * @param buf_count Number of provided receive buffers (a power of two).
+ * @param buf_size Size of each provided receive buffer.
+ *
+ * @return 0 on success, -1 if the kernel does not support what we need.
+ */
+int uring_init(uring_t* ring, unsigned entries, unsigned buf_count,
+               unsigned buf_size);
+
+/**
+ * Releases every resource of the ring.
+ */
+void uring_exit(uring_t* ring);
+
+/**
+ * Returns a zeroed submission queue entry, submitting pending entries first
+ * if the queue is full.
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+/**
+ * Submits the pending entries and waits for at least `wait_nr` completions.
+ *
+ * @return The number of entries submitted, or -1 on error.
+ */
+int uring_submit(uring_t* ring, unsigned wait_nr);
+
+/**
+ * Returns the oldest completion, or NULL if the completion queue is empty.
+ * The caller must call `uring_cqe_seen` once done with it.
+ */
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring);
+
+/**
+ * Marks the oldest completion as consumed.
+ */
+void uring_cqe_seen(uring_t* ring);
+
+/**
+ * Returns the provided buffer with the given id.
+ */
+uint8_t* uring_buf(uring_t* ring, uint16_t bid);
+
+/**
+ * Gives a provided buffer back to the kernel.
+ */
+void uring_recycle_buf(uring_t* ring, uint16_t bid);
+
+#endif  // FOGGY_URING_H_
@@ -0,0 +1,509 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+using namespace std;
+
+#include "foggy_tcp.h"
+
+#define BUF_SIZE 4096
+#define CONTENTION_INFLIGHT 65536
+#define PATH_MAX_DATAGRAM 65536
+/* Kernel buffer of the relay socket, so that the bursts of slow start wait
+ * in the emulated queue rather than overflow it (capped by rmem_max) */
+#define PATH_SOCKET_BUFFER (4 * 1024 * 1024)
+/* Socket buffers of the transfer, in bandwidth-delay products */
+#define PATH_BUFFER_BDPS 4
+
+/**
+ * This file implements a benchmark for the foggy-TCP backend. Both ends of
+ * every connection run in this process over the loopback interface.
+ *
+ * Usage: ./bench flows <num-flows> <bytes-per-flow> <backend-threads> [port]
+ *                    [syscall|uring|zerocopy]
+ *
+ *   Runs <num-flows> concurrent transfers of <bytes-per-flow> bytes. All the
+ *   listeners share one port (FOGGY_OPT_REUSEPORT), so the kernel spreads
+ *   the flows over the listeners and the connections are sharded over <backend-threads>
+ *   backend event loops. Prints the aggregate goodput and the CPU time. The
+ *   last argument picks the backend I/O engine (syscall by default);
+ *   zerocopy is the syscall engine sending UDP GSO runs with MSG_ZEROCOPY.
+ *
+ * Usage: ./bench contention <bytes> <msg-size> [port] [syscall|uring|zerocopy]
+ *
+ *   One application thread drives both ends of a single connection with
+ *   <msg-size> bytes foggy_write() and foggy_read() calls, alternating
+ *   between them once CONTENTION_INFLIGHT bytes are in flight, while the
+ *   backend processes the packets. Prints the rate of calls, the goodput and
+ *   the CPU time: it measures the cost of the handoff between the
+ *   application and the backend.
+ *
+ * Usage: ./bench path <bytes> <rate-mbit> <delay-ms> [port] [algorithms]
+ *
+ *   Sends <bytes> over one connection through a relay thread that emulates
+ *   the link of the Vagrant VMs (`tcset --rate --delay` on both hosts): in
+ *   each direction, datagrams are serialized at <rate-mbit> Mbit/s, then
+ *   delayed by <delay-ms>. In front of the link, a drop-tail queue holds one
+ *   bandwidth-delay product. The buffers of the sockets are raised to
+ *   PATH_BUFFER_BDPS bandwidth-delay products if the defaults are smaller.
+ *   The transfer runs once without window scaling, then once with it for
+ *   each congestion control algorithm of the comma-separated <algorithms>
+ *   ("reno" by default; the first one also runs the first transfer), and
+ *   prints the goodput, the data segments the queue dropped and their
+ *   average queueing delay for each. The relay listens on <port> + 1.
+ *
+ * Results are printed on stderr.
+ *
+ * For example:
+ * ./bench flows 64 10000000 4
+ * ./bench flows 64 10000000 4 3120 uring
+ * ./bench contention 100000000 64
+ * ./bench path 50000000 100 20
+ * ./bench path 50000000 100 20 3120 reno,cubic,bbr
+ */
+
+struct flow_t {
+  void* listener;
+  void* initiator;
+  long bytes;
+  long received;
+};
+
+static double elapsed_sec(const struct timespec& start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double cpu_sec() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void* flow_reader(void* in) {
+  flow_t* flow = (flow_t*)in;
+  char buf[BUF_SIZE];
+
+  while (flow->received < flow->bytes) {
+    int bytes_read = foggy_read(flow->listener, buf, BUF_SIZE);
+    if (bytes_read <= 0) break;
+    flow->received += bytes_read;
+  }
+  return NULL;
+}
+
+static void* flow_writer(void* in) {
+  flow_t* flow = (flow_t*)in;
+  char buf[BUF_SIZE];
+  long sent = 0;
+
+  memset(buf, 'f', BUF_SIZE);
+  while (sent < flow->bytes) {
+    int len = flow->bytes - sent < BUF_SIZE ? flow->bytes - sent : BUF_SIZE;
+    if (foggy_write(flow->initiator, buf, len) < 0) {
+      cerr << "Error: Write failed\n";
+      break;
+    }
+    sent += len;
+  }
+  foggy_close(flow->initiator);
+  return NULL;
+}
+
+static void set_engine(const char* engine) {
+  int io_engine = strcmp(engine, "uring") == 0 ? FOGGY_IO_URING
+                                               : FOGGY_IO_SYSCALL;
+  foggy_setsockopt(NULL, FOGGY_OPT_IO_ENGINE, io_engine);
+  if (strcmp(engine, "zerocopy") == 0) {
+    foggy_setsockopt(NULL, FOGGY_OPT_UDP_OFFLOAD, 1);
+    foggy_setsockopt(NULL, FOGGY_OPT_ZEROCOPY, 1);
+  }
+}
+
+static int bench_flows(int num_flows, long bytes, int threads,
+                       const char* port, const char* engine) {
+  if (foggy_setsockopt(NULL, FOGGY_OPT_BACKEND_THREADS, threads) < 0) {
+    cerr << "Error: Invalid number of backend threads\n";
+    return -1;
+  }
+  set_engine(engine);
+  foggy_setsockopt(NULL, FOGGY_OPT_REUSEPORT, 1);
+
+  flow_t* flows = new flow_t[num_flows];
+  pthread_t* readers = new pthread_t[num_flows];
+  pthread_t* writers = new pthread_t[num_flows];
+
+  /* Create every listener first so that the kernel can give each new flow
+   * to a listener that is not yet connected */
+  for (int i = 0; i < num_flows; ++i) {
+    flows[i].listener = foggy_socket(TCP_LISTENER, port, "127.0.0.1");
+    flows[i].bytes = bytes;
+    flows[i].received = 0;
+  }
+  for (int i = 0; i < num_flows; ++i) {
+    flows[i].initiator = foggy_socket(TCP_INITIATOR, port, "127.0.0.1");
+    if (flows[i].listener == NULL || flows[i].initiator == NULL) {
+      cerr << "Error: Can't create sockets\n";
+      return -1;
+    }
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  double cpu_start = cpu_sec();
+
+  for (int i = 0; i < num_flows; ++i) {
+    pthread_create(&readers[i], NULL, flow_reader, &flows[i]);
+    pthread_create(&writers[i], NULL, flow_writer, &flows[i]);
+  }
+  long total = 0;
+  for (int i = 0; i < num_flows; ++i) {
+    pthread_join(writers[i], NULL);
+    pthread_join(readers[i], NULL);
+    total += flows[i].received;
+  }
+
+  double seconds = elapsed_sec(start);
+  double cpu = cpu_sec() - cpu_start;
+  fprintf(stderr,
+          "flows=%d threads=%d engine=%s bytes=%ld time=%.3fs "
+          "goodput=%.1fMbit/s cpu=%.3fs\n",
+          num_flows, threads, engine, total, seconds,
+          total * 8 / seconds / 1e6, cpu);
+  return total == num_flows * bytes ? 0 : -1;
+}
+
+static int bench_contention(long bytes, int msg_size, const char* port,
+                            const char* engine) {
+  if (msg_size <= 0) {
+    cerr << "Error: Invalid message size\n";
+    return -1;
+  }
+  set_engine(engine);
+
+  void* listener = foggy_socket(TCP_LISTENER, port, "127.0.0.1");
+  void* initiator = foggy_socket(TCP_INITIATOR, port, "127.0.0.1");
+  if (listener == NULL || initiator == NULL) {
+    cerr << "Error: Can't create sockets\n";
+    return -1;
+  }
+  char* buf = new char[msg_size];
+  memset(buf, 'f', msg_size);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  double cpu_start = cpu_sec();
+
+  long sent = 0, received = 0, calls = 0;
+  while (received < bytes) {
+    if (sent < bytes && sent - received < CONTENTION_INFLIGHT) {
+      int len = bytes - sent < msg_size ? bytes - sent : msg_size;
+      if (foggy_write(initiator, buf, len) < 0) {
+        cerr << "Error: Write failed\n";
+        break;
+      }
+      sent += len;
+    } else {
+      int bytes_read = foggy_read(listener, buf, msg_size);
+      if (bytes_read <= 0) break;
+      received += bytes_read;
+    }
+    ++calls;
+  }
+
+  double seconds = elapsed_sec(start);
+  double cpu = cpu_sec() - cpu_start;
+  foggy_close(initiator);
+  fprintf(stderr,
+          "contention msg=%d engine=%s bytes=%ld calls=%ld time=%.3fs "
+          "rate=%.0fcalls/s goodput=%.1fMbit/s cpu=%.3fs\n",
+          msg_size, engine, received, calls, seconds, calls / seconds,
+          received * 8 / seconds / 1e6, cpu);
+  delete[] buf;
+  return received == bytes ? 0 : -1;
+}
+
+/* A datagram crossing the emulated path */
+struct path_pkt_t {
+  int64_t due;  // When it leaves the relay, CLOCK_MONOTONIC ns.
+  int len;
+  char* data;
+};
+
+/* One direction of the emulated path */
+struct path_dir_t {
+  deque<path_pkt_t> queue;
+  int64_t link_free;  // When the link is done serializing its queue.
+  long dropped;
+  long forwarded;
+  int64_t queued;  // Total time the forwarded datagrams waited, ns.
+};
+
+struct path_t {
+  int fd;
+  struct sockaddr_in server;  // The listener.
+  struct sockaddr_in client;  // The initiator, once it sent something.
+  int has_client;
+  double ns_per_byte;
+  int64_t delay;  // ns.
+  int64_t queue_limit;  // Longest wait for the link, ns.
+  path_dir_t to_server;
+  path_dir_t to_client;
+  volatile int stop;
+};
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void path_enqueue(path_t* path, path_dir_t* dir, const char* data,
+                         int len) {
+  int64_t now = now_ns();
+
+  if (dir->link_free - now > path->queue_limit) {
+    ++dir->dropped;
+    return;
+  }
+  if (dir->link_free < now) {
+    dir->link_free = now;
+  }
+  ++dir->forwarded;
+  dir->queued += dir->link_free - now;
+  dir->link_free += (int64_t)(len * path->ns_per_byte);
+
+  path_pkt_t pkt;
+  pkt.due = dir->link_free + path->delay;
+  pkt.len = len;
+  pkt.data = (char*)malloc(len);
+  memcpy(pkt.data, data, len);
+  dir->queue.push_back(pkt);
+}
+
+static void path_dequeue(path_t* path, path_dir_t* dir,
+                         const struct sockaddr_in* to, int64_t now) {
+  while (!dir->queue.empty() && dir->queue.front().due <= now) {
+    path_pkt_t& pkt = dir->queue.front();
+    sendto(path->fd, pkt.data, pkt.len, 0, (const struct sockaddr*)to,
+           sizeof(*to));
+    free(pkt.data);
+    dir->queue.pop_front();
+  }
+}
+
+static void path_clear(path_dir_t* dir) {
+  for (size_t i = 0; i < dir->queue.size(); ++i) {
+    free(dir->queue[i].data);
+  }
+  dir->queue.clear();
+}
+
+/* Relays datagrams between the initiator and the listener */
+static void* path_relay(void* in) {
+  path_t* path = (path_t*)in;
+  char* buf = new char[PATH_MAX_DATAGRAM];
+  path_dir_t* dirs[2] = {&path->to_server, &path->to_client};
+
+  while (!path->stop) {
+    int64_t now = now_ns();
+    int64_t wait = 10000000;
+
+    for (int i = 0; i < 2; ++i) {
+      if (!dirs[i]->queue.empty() && dirs[i]->queue.front().due - now < wait) {
+        wait = dirs[i]->queue.front().due - now;
+      }
+    }
+    if (wait > 0) {
+      struct pollfd pfd = {path->fd, POLLIN, 0};
+      struct timespec timeout = {(time_t)(wait / 1000000000),
+                                 (long)(wait % 1000000000)};
+      ppoll(&pfd, 1, &timeout, NULL);
+    }
+
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int len;
+    while ((len = recvfrom(path->fd, buf, PATH_MAX_DATAGRAM, MSG_DONTWAIT,
+                           (struct sockaddr*)&from, &from_len)) > 0) {
+      if (from.sin_port == path->server.sin_port) {
+        path_enqueue(path, &path->to_client, buf, len);
+      } else {
+        path->client = from;
+        path->has_client = 1;
+        path_enqueue(path, &path->to_server, buf, len);
+      }
+      from_len = sizeof(from);
+    }
+
+    now = now_ns();
+    path_dequeue(path, &path->to_server, &path->server, now);
+    if (path->has_client) {
+      path_dequeue(path, &path->to_client, &path->client, now);
+    }
+  }
+  delete[] buf;
+  return NULL;
+}
+
+static int path_transfer(long bytes, double rate_mbit, int delay_ms,
+                         const char* port, int window_scale, const char* cc) {
+  path_t path;
+  int portno = atoi(port);
+  char relay_port[16];
+
+  foggy_setsockopt(NULL, FOGGY_OPT_WINDOW_SCALE, window_scale);
+  if (foggy_set_congestion_control(NULL, cc) < 0) {
+    cerr << "Error: Unknown congestion control " << cc << "\n";
+    return -1;
+  }
+
+  path.fd = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&path.server, 0, sizeof(path.server));
+  path.server.sin_family = AF_INET;
+  path.server.sin_addr.s_addr = inet_addr("127.0.0.1");
+  path.server.sin_port = htons(portno + 1);
+  if (path.fd < 0 || bind(path.fd, (struct sockaddr*)&path.server,
+                          sizeof(path.server)) < 0) {
+    cerr << "Error: Can't bind the relay\n";
+    return -1;
+  }
+  int buffer = PATH_SOCKET_BUFFER;
+  setsockopt(path.fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+  path.server.sin_port = htons(portno);
+  path.has_client = 0;
+  path.ns_per_byte = 8e3 / rate_mbit;
+  path.delay = (int64_t)delay_ms * 1000000;
+  path.queue_limit = 2 * path.delay;
+  path.to_server.link_free = 0;
+  path.to_client.link_free = 0;
+  path.to_server.dropped = 0;
+  path.to_client.dropped = 0;
+  path.to_server.forwarded = 0;
+  path.to_server.queued = 0;
+  path.to_client.forwarded = 0;
+  path.to_client.queued = 0;
+  path.stop = 0;
+  snprintf(relay_port, sizeof(relay_port), "%d", portno + 1);
+
+  flow_t flow;
+  flow.listener = foggy_socket(TCP_LISTENER, port, "127.0.0.1");
+  flow.initiator = foggy_socket(TCP_INITIATOR, relay_port, "127.0.0.1");
+  flow.bytes = bytes;
+  flow.received = 0;
+  if (flow.listener == NULL || flow.initiator == NULL) {
+    cerr << "Error: Can't create sockets\n";
+    return -1;
+  }
+
+  pthread_t relay, reader, writer;
+  pthread_create(&relay, NULL, path_relay, &path);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&reader, NULL, flow_reader, &flow);
+  pthread_create(&writer, NULL, flow_writer, &flow);
+  pthread_join(reader, NULL);
+  double seconds = elapsed_sec(start);
+  pthread_join(writer, NULL);
+  /* The next transfer reuses the port: the listener must be gone */
+  foggy_close(flow.listener);
+
+  path.stop = 1;
+  pthread_join(relay, NULL);
+  close(path.fd);
+  path_clear(&path.to_server);
+  path_clear(&path.to_client);
+
+  fprintf(stderr,
+          "path rate=%.0fMbit/s delay=%dms window_scale=%s cc=%s bytes=%ld "
+          "time=%.3fs goodput=%.1fMbit/s dropped=%ld queueing=%.1fms\n",
+          rate_mbit, delay_ms, window_scale ? "on" : "off", cc,
+          flow.received, seconds, flow.received * 8 / seconds / 1e6,
+          path.to_server.dropped,
+          path.to_server.queued / 1e6 /
+              (path.to_server.forwarded > 0 ? path.to_server.forwarded : 1));
+  return flow.received == bytes ? 0 : -1;
+}
+
+static int bench_path(long bytes, double rate_mbit, int delay_ms,
+                      const char* port, const char* algorithms) {
+  char names[256];
+  char* save;
+
+  if (rate_mbit <= 0 || delay_ms < 0) {
+    cerr << "Error: Invalid path\n";
+    return -1;
+  }
+  /* The buffers must not limit the window, nor leave the sender out of
+   * data while the congestion control probes above the bandwidth-delay
+   * product */
+  double bdp = rate_mbit * 1e6 / 8 * 2 * delay_ms / 1e3;
+  if (PATH_BUFFER_BDPS * bdp > SNDBUF_DEFAULT) {
+    foggy_setsockopt(NULL, FOGGY_OPT_SNDBUF, (int)(PATH_BUFFER_BDPS * bdp));
+  }
+  if (PATH_BUFFER_BDPS * bdp > RCVBUF_DEFAULT) {
+    foggy_setsockopt(NULL, FOGGY_OPT_RCVBUF, (int)(PATH_BUFFER_BDPS * bdp));
+  }
+
+  snprintf(names, sizeof(names), "%s", algorithms);
+  char* cc = strtok_r(names, ",", &save);
+  if (cc == NULL ||
+      path_transfer(bytes, rate_mbit, delay_ms, port, 0, cc) < 0) {
+    return -1;
+  }
+  for (; cc != NULL; cc = strtok_r(NULL, ",", &save)) {
+    if (path_transfer(bytes, rate_mbit, delay_ms, port, 1, cc) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc >= 5 && strcmp(argv[1], "flows") == 0) {
+    return bench_flows(atoi(argv[2]), atol(argv[3]), atoi(argv[4]),
+                       argc > 5 ? argv[5] : "3120",
+                       argc > 6 ? argv[6] : "syscall");
+  }
+  if (argc >= 4 && strcmp(argv[1], "contention") == 0) {
+    return bench_contention(atol(argv[2]), atoi(argv[3]),
+                            argc > 4 ? argv[4] : "3120",
+                            argc > 5 ? argv[5] : "syscall");
+  }
+
+  if (argc >= 5 && strcmp(argv[1], "path") == 0) {
+    return bench_path(atol(argv[2]), atof(argv[3]), atoi(argv[4]),
+                      argc > 5 ? argv[5] : "3120",
+                      argc > 6 ? argv[6] : "reno");
+  }
+
+  cerr << "Usage: " << argv[0]
+       << " flows <num-flows> <bytes-per-flow> <backend-threads> [port]"
+          " [syscall|uring|zerocopy]\n"
+       << "       " << argv[0]
+       << " contention <bytes> <msg-size> [port] [syscall|uring|zerocopy]\n"
+       << "       " << argv[0]
+       << " path <bytes> <rate-mbit> <delay-ms> [port] [algorithms]\n";
+  return -1;
+}
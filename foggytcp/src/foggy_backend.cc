@@ -15,13 +15,20 @@ from releasing their forks in any public places. */
  * in this file.
  */
 
+#include <arpa/inet.h>
 #include <assert.h>
+#include <linux/errqueue.h>
+#include <netinet/udp.h>
+#include <errno.h>
 #include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h> // Ncessaire pour clock_gettime
@@ -31,8 +38,11 @@ from releasing their forks in any public places. */
 #include "foggy_packet.h"
 #include "foggy_tcp.h"
 
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
+#define BACKEND_MAX_EVENTS 64
+
  /**
   * Fonction utilitaire pour obtenir le temps actuel en millisecondes.
   */
@@ -43,6 +53,15 @@ long get_time_in_ms() {
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+int64_t get_time_in_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 
 /**
  * Tells if a given sequence number has been acknowledged by the socket.
@@ -53,146 +72,1400 @@ long get_time_in_ms() {
  * @return 1 if the sequence number has been acknowledged, 0 otherwise.
  */
 int has_been_acked(foggy_socket_t* sock, uint32_t seq) {
-    int result;
-    while (pthread_mutex_lock(&(sock->window.ack_lock)) != 0) {
-    }
     // Utilise la macro 'after' de foggy_function.h
-    result = after(sock->window.last_ack_received, seq);
-    pthread_mutex_unlock(&(sock->window.ack_lock));
-    return result;
+    return after(__atomic_load_n(&(sock->window.last_ack_received),
+        __ATOMIC_ACQUIRE), seq);
+}
+
+/**
+ * Decides whether a datagram belongs to the connection of the socket.
+ *
+ * A listener adopts the first peer whose SYN reaches it and connects its UDP
+ * socket to that peer. Within a SO_REUSEPORT group (FOGGY_OPT_REUSEPORT)
+ * the kernel then prefers this socket for the datagrams of that peer, and
+ * gives new flows to the listeners that are still unconnected; with
+ * connected sockets in the group, it picks among those by scoring them
+ * rather than by hashing the flow.
+ *
+ * @param sock The socket that received the datagram.
+ * @param buf The datagram.
+ * @param len The length of the datagram.
+ * @param from The source address of the datagram.
+ *
+ * @return 1 if the datagram should be processed, 0 if it must be dropped.
+ */
+static int accept_peer(foggy_socket_t* sock, uint8_t* buf, uint32_t len,
+    struct sockaddr_in* from) {
+    if (sock->type == TCP_INITIATOR) {
+        sock->conn = *from;
+        return 1;
+    }
+    if (sock->is_connected) {
+        return from->sin_addr.s_addr == sock->conn.sin_addr.s_addr &&
+            from->sin_port == sock->conn.sin_port;
+    }
+    // Strays of an older connection must not take the listener.
+    if (len < sizeof(foggy_tcp_header_t) ||
+        (get_flags((foggy_tcp_header_t*)buf) &
+            (SYN_FLAG_MASK | ACK_FLAG_MASK)) != SYN_FLAG_MASK) {
+        return 0;
+    }
+    sock->conn = *from;
+    if (connect(sock->socket, (struct sockaddr*)from, sizeof(*from)) < 0) {
+        perror("ERROR connecting to peer");
+    }
+    sock->is_connected = 1;
+    return 1;
+}
+
+/**
+ * Returns the segment size of a datagram coalesced by UDP GRO, or the length
+ * of the datagram if the kernel did not coalesce it.
+ *
+ * @param hdr The message header filled by recvmmsg().
+ * @param len The length of the datagram.
+ */
+static uint32_t get_gro_size(struct msghdr* hdr, uint32_t len) {
+    struct cmsghdr* cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int gro_size;
+            memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(gro_size));
+            if (gro_size > 0) {
+                return gro_size;
+            }
+        }
+    }
+    return len > 0 ? len : 1;
+}
+
+/**
+ * Hands the segments of one received datagram to `on_recv_pkt`. With UDP
+ * GRO, one datagram carries a run of segments of `seg_size` bytes (the last
+ * one may be shorter), each with its own header.
+ *
+ * @param sock The socket that received the datagram.
+ * @param buf The datagram.
+ * @param len The length of the datagram.
+ * @param seg_size The size of the coalesced segments, or `len`.
+ * @param from The source address of the datagram.
+ */
+static void deliver_datagram(foggy_socket_t* sock, uint8_t* buf, uint32_t len,
+    uint32_t seg_size, struct sockaddr_in* from) {
+    if (!accept_peer(sock, buf, len, from)) {
+        return;
+    }
+    for (uint32_t off = 0; off < len; off += seg_size) {
+        uint8_t* pkt = buf + off;
+        uint32_t pkt_len = MIN(seg_size, len - off);
+
+        // Drop runts and anything that is not ours.
+        if (pkt_len < sizeof(foggy_tcp_header_t) ||
+            ntohl(((foggy_tcp_header_t*)pkt)->identifier) != IDENTIFIER ||
+            get_plen((foggy_tcp_header_t*)pkt) > pkt_len ||
+            get_plen((foggy_tcp_header_t*)pkt) <
+                get_hlen((foggy_tcp_header_t*)pkt) ||
+            get_hlen((foggy_tcp_header_t*)pkt) < sizeof(foggy_tcp_header_t) +
+                get_extension_length((foggy_tcp_header_t*)pkt)) {
+            continue;
+        }
+        on_recv_pkt(sock, pkt);
+    }
+}
+
+/**
+ * Posts a multishot receive for the socket on the shard's io_uring. Every
+ * datagram then completes into a buffer of the provided buffer ring.
+ *
+ * @param sock The socket to receive on.
+ */
+static void uring_arm_recv(foggy_socket_t* sock) {
+    backend_shard_t* shard = sock->shard;
+    struct io_uring_sqe* sqe = uring_get_sqe(&(shard->uring));
+
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sock->socket;
+    sqe->addr = (uint64_t)(uintptr_t)&(shard->uring_recv_hdr);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = shard->uring.buf_group;
+    sqe->user_data = (uint64_t)(uintptr_t)sock | URING_TAG_RECV;
+    uring_submit(&(shard->uring), 0);
+    sock->uring_armed = 1;
+}
+
+/**
+ * io_uring counterpart of the recvmmsg() path of `check_for_pkt`: processes
+ * up to BACKEND_RECV_BATCH datagrams completed by the multishot receive and
+ * gives their buffers back to the kernel.
+ *
+ * @param sock The socket whose datagrams are processed.
+ *
+ * @return The number of datagrams processed.
+ */
+static int uring_recv_pkts(foggy_socket_t* sock) {
+    backend_shard_t* shard = sock->shard;
+    uint32_t name_len = shard->uring_recv_hdr.msg_namelen;
+    uint32_t ctrl_len = shard->uring_recv_hdr.msg_controllen;
+    int n = 0;
+
+    while (!sock->uring_pending.empty() && n < BACKEND_RECV_BATCH) {
+        uint64_t entry = sock->uring_pending.front();
+        uint16_t bid = entry >> 32;
+        uint32_t res = (uint32_t)entry;
+        uint8_t* buf = uring_buf(&(shard->uring), bid);
+        struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+
+        sock->uring_pending.pop_front();
+        ++n;
+        // The buffer holds the io_uring_recvmsg_out header, the source
+        // address, the control messages and finally the payload.
+        if (res >= sizeof(*out) + name_len + ctrl_len &&
+            !(out->flags & MSG_TRUNC)) {
+            struct msghdr ctrl;
+            memset(&ctrl, 0, sizeof(ctrl));
+            ctrl.msg_control = buf + sizeof(*out) + name_len;
+            ctrl.msg_controllen = out->controllen;
+            deliver_datagram(sock, buf + sizeof(*out) + name_len + ctrl_len,
+                out->payloadlen, get_gro_size(&ctrl, out->payloadlen),
+                (struct sockaddr_in*)(buf + sizeof(*out)));
+        }
+        uring_recycle_buf(&(shard->uring), bid);
+    }
+
+    // The multishot receive stops when it runs out of buffers; post it again
+    // now that some were given back.
+    if (!sock->uring_armed && sock->is_registered) {
+        uring_arm_recv(sock);
+    }
+    return n;
 }
 
 /**
  * Checks if the socket received any data.
  *
- * It first peeks at the header to figure out the length of the packet and
- * then reads the entire packet.
+ * A single recvmmsg() drains up to BACKEND_RECV_BATCH datagrams into the
+ * shard's preallocated receive buffers. The datagrams are then split into
+ * segments if UDP GRO coalesced them, checked, and handed to `on_recv_pkt`
+ * one after the other, in arrival order. With the io_uring engine, the
+ * datagrams already completed by the multishot receive are processed
+ * instead.
  *
  * @param sock The socket used for receiving data on the connection.
  * @param flags Flags that determine how the socket should wait for data.
  * Check `foggy_read_mode_t` for more information.
+ *
+ * @return The number of datagrams received, 0 if none was available.
  */
-void check_for_pkt(foggy_socket_t* sock, foggy_read_mode_t flags) {
-    foggy_tcp_header_t hdr;
-    uint8_t* pkt;
-    socklen_t conn_len = sizeof(sock->conn);
-    ssize_t len = 0;
-    uint32_t plen = 0, buf_size = 0, n = 0;
+int check_for_pkt(foggy_socket_t* sock, foggy_read_mode_t flags) {
+    backend_shard_t* shard = sock->shard;
+    int recv_flags, n, i;
 
-    while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+    if (sock->io_engine == FOGGY_IO_URING) {
+        return uring_recv_pkts(sock);
     }
+
     switch (flags) {
     case NO_FLAG:
-        len = recvfrom(sock->socket, &hdr, sizeof(foggy_tcp_header_t), MSG_PEEK,
-            (struct sockaddr*)&(sock->conn), &conn_len);
+        recv_flags = MSG_WAITFORONE;
         break;
 
-        // Fallthrough.
     case NO_WAIT:
-        len = recvfrom(sock->socket, &hdr, sizeof(foggy_tcp_header_t),
-            MSG_DONTWAIT | MSG_PEEK, (struct sockaddr*)&(sock->conn),
-            &conn_len);
+        recv_flags = MSG_DONTWAIT;
         break;
 
     default:
         perror("ERROR unknown flag");
+        return 0;
     }
-    if (len >= (ssize_t)sizeof(foggy_tcp_header_t)) {
-        plen = get_plen(&hdr);
-        pkt = (uint8_t*)malloc(plen);
-        while (buf_size < plen) {
-            n = recvfrom(sock->socket, pkt + buf_size, plen - buf_size, 0,
-                (struct sockaddr*)&(sock->conn), &conn_len);
-            buf_size = buf_size + n;
+
+    // recvmmsg() overwrites the lengths, reset them before every call.
+    for (i = 0; i < BACKEND_RECV_BATCH; ++i) {
+        shard->recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        shard->recv_msgs[i].msg_hdr.msg_controllen = BACKEND_CMSG_SIZE;
+        shard->recv_msgs[i].msg_hdr.msg_flags = 0;
+    }
+    n = recvmmsg(sock->socket, shard->recv_msgs, BACKEND_RECV_BATCH, recv_flags,
+        NULL);
+    if (n <= 0) {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("ERROR receiving packets");
         }
-        on_recv_pkt(sock, pkt);
-        free(pkt);
+        return 0;
+    }
+
+    for (i = 0; i < n; ++i) {
+        uint32_t len = shard->recv_msgs[i].msg_len;
+
+        if (shard->recv_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            continue;
+        }
+        deliver_datagram(sock, shard->recv_bufs + i * BACKEND_RECV_BUF_SIZE,
+            len, get_gro_size(&(shard->recv_msgs[i].msg_hdr), len),
+            &(shard->recv_addrs[i]));
     }
-    pthread_mutex_unlock(&(sock->recv_lock));
+    return n;
 }
 
-void* begin_backend(void* in) {
-    foggy_socket_t* sock = (foggy_socket_t*)in;
-    int death, buf_len, send_signal;
-    uint8_t* data;
+void queue_pkt(foggy_socket_t* sock, uint8_t* pkt, int owned) {
+    struct iovec iov;
 
-    long current_time_ms, last_send_time_ms, elapsed_time_ms;
+    iov.iov_base = pkt;
+    iov.iov_len = get_plen((foggy_tcp_header_t*)pkt);
+    queue_pkt_iov(sock, &iov, 1, owned ? pkt : NULL);
+}
 
-    while (1) {
-        while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
+void queue_pkt_iov(foggy_socket_t* sock, const struct iovec* iov, int iovcnt,
+    uint8_t* owned) {
+    backend_shard_t* shard = sock->shard;
+    int i, first, j;
+
+    if (shard->send_sock != sock || shard->send_count == BACKEND_SEND_BATCH) {
+        flush_pkts(shard->send_sock);
+    }
+    shard->send_sock = sock;
+
+    i = shard->send_count++;
+    first = shard->send_iov_first[i];
+    shard->send_len[i] = 0;
+    for (j = 0; j < iovcnt; ++j) {
+        shard->send_iovs[first + j] = iov[j];
+        shard->send_len[i] += iov[j].iov_len;
+    }
+    shard->send_iov_first[i + 1] = first + iovcnt;
+    shard->send_owned[i] = owned;
+}
+
+/**
+ * Returns the number of page fragments a zero-copy send needs for a queued
+ * packet: one for its header, which is copied to a header slot, and one per
+ * page its payload spans.
+ *
+ * @param shard The shard owning the batch.
+ * @param i The packet.
+ */
+static int packet_frags(backend_shard_t* shard, int i) {
+    int frags = 1;
+
+    for (int j = shard->send_iov_first[i] + 1; j < shard->send_iov_first[i + 1];
+        ++j) {
+        uintptr_t start = (uintptr_t)shard->send_iovs[j].iov_base;
+        uintptr_t end = start + shard->send_iovs[j].iov_len;
+        if (end > start) {
+            frags += (end - 1) / ZEROCOPY_PAGE_SIZE - start / ZEROCOPY_PAGE_SIZE +
+                1;
         }
-        death = sock->dying;
-        pthread_mutex_unlock(&(sock->death_lock));
+    }
+    return frags;
+}
+
+/**
+ * Builds the messages of a transmit batch into shard->gso_msgs. With GSO,
+ * each run of equal-sized packets (the last one may be shorter) becomes a
+ * single message with the iovecs of all its packets and a UDP_SEGMENT control
+ * message, and the kernel splits it back into datagrams. Without GSO, every packet is
+ * its own message.
+ *
+ * @param shard The shard owning the batch.
+ * @param first The first queued packet to include.
+ * @param use_gso Whether runs of packets may be coalesced.
+ * @param max_frags If non-zero, runs are cut so that a zero-copy send of the
+ *                  message needs at most this many page fragments.
+ *
+ * @return The number of messages built.
+ */
+static int build_send_msgs(backend_shard_t* shard, int first, int use_gso,
+    int max_frags) {
+    int count = 0, i = first;
+
+    while (i < shard->send_count) {
+        struct msghdr* hdr = &(shard->gso_msgs[count].msg_hdr);
+        size_t seg_size = shard->send_len[i];
+        size_t total = seg_size;
+        int run = 1, frags = max_frags > 0 ? packet_frags(shard, i) : 0;
 
-        // ------------------------------------------------------------------
-        // NOUVELLE LOGIQUE: VRIFICATION ET GESTION DU TIMER DE RETRANSMISSION
-        // ------------------------------------------------------------------
-        if (sock->window.retransmit_timeout > 0 && !sock->send_window.empty()) {
+        while (use_gso && i + run < shard->send_count &&
+            run < BACKEND_GSO_MAX_SEGMENTS &&
+            shard->send_len[i + run - 1] == seg_size &&
+            shard->send_len[i + run] <= seg_size &&
+            total + shard->send_len[i + run] <= BACKEND_GSO_MAX_BYTES) {
+            if (max_frags > 0) {
+                frags += packet_frags(shard, i + run);
+                if (frags > max_frags) {
+                    break;
+                }
+            }
+            total += shard->send_len[i + run];
+            ++run;
+        }
 
-            current_time_ms = get_time_in_ms();
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = &(shard->send_sock->conn);
+        hdr->msg_namelen = sizeof(shard->send_sock->conn);
+        hdr->msg_iov = &(shard->send_iovs[shard->send_iov_first[i]]);
+        hdr->msg_iovlen =
+            shard->send_iov_first[i + run] - shard->send_iov_first[i];
+        if (run > 1) {
+            uint16_t gso_size = seg_size;
+            struct cmsghdr* cmsg;
 
-            // Convertir le temps de dpart struct timespec en ms
-            last_send_time_ms = sock->window.last_send_time.tv_sec * 1000 +
-                sock->window.last_send_time.tv_nsec / 1000000;
+            hdr->msg_control = shard->gso_ctrl[count];
+            hdr->msg_controllen = BACKEND_CMSG_SIZE;
+            cmsg = CMSG_FIRSTHDR(hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(gso_size));
+            memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+            hdr->msg_controllen = CMSG_SPACE(sizeof(gso_size));
+        }
+        shard->gso_first[count] = i;
+        ++count;
+        i += run;
+    }
+    return count;
+}
 
-            elapsed_time_ms = current_time_ms - last_send_time_ms;
+static void activate_socket(backend_shard_t* shard, foggy_socket_t* sock);
 
-            // Si le temps coul est suprieur ou gal au RTO
-            if (elapsed_time_ms >= sock->window.retransmit_timeout) {
-                // Timeout dtect! Le timer doit tre gr sous lock si ncessaire, 
-                // mais l'appel  on_retransmit_timer() le gre dj.
-                on_retransmit_timer(sock);
+/**
+ * Releases a SENDMSG entry of the io_uring engine once the kernel completed
+ * it. Its payload may leave the send ring at the socket's next round.
+ *
+ * @param shard The shard owning the ring.
+ * @param send The entry.
+ * @param res The result of the send.
+ */
+static void uring_send_done(backend_shard_t* shard, uring_send_t* send,
+    int res) {
+    foggy_socket_t* sock = send->sock;
+
+    if (res < 0) {
+        if (send->msg.msg_controllen > 0 && (res == -EIO || res == -EINVAL)) {
+            // As in flush_pkts(): the kernel or the device cannot segment.
+            sock->gso_enabled = 0;
+        }
+        else {
+            errno = -res;
+            perror("ERROR sending packets");
+        }
+    }
+    for (int i = 0; i < send->owned_count; ++i) {
+        pool_put(&(shard->pool), send->owned[i]);
+    }
+    sock->uring_sends--;
+    send->next_free = shard->uring_free_sends;
+    shard->uring_free_sends = send;
+    if (send->pending != NULL) {
+        send->pending->done = 1;
+        if (sock->is_registered) {
+            activate_socket(shard, sock);
+        }
+    }
+}
+
+/**
+ * Handles a completion of the shard's io_uring. Received datagrams are
+ * queued on their socket until `check_for_pkt` processes them.
+ *
+ * @param shard The shard owning the ring.
+ * @param cqe The completion.
+ */
+static void handle_uring_cqe(backend_shard_t* shard, struct io_uring_cqe* cqe) {
+    foggy_socket_t* sock;
+
+    if ((cqe->user_data & URING_TAG_MASK) == URING_TAG_SEND) {
+        uring_send_done(shard, (uring_send_t*)(uintptr_t)
+            (cqe->user_data & ~(uint64_t)URING_TAG_MASK), cqe->res);
+        return;
+    }
+    if ((cqe->user_data & URING_TAG_MASK) != URING_TAG_RECV) {
+        return;
+    }
+    sock = (foggy_socket_t*)(uintptr_t)(cqe->user_data & ~URING_TAG_MASK);
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        sock->uring_armed = 0;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res >= 0 && sock->is_registered) {
+            sock->uring_pending.push_back(((uint64_t)bid << 32) |
+                (uint32_t)cqe->res);
+        }
+        else {
+            uring_recycle_buf(&(shard->uring), bid);
+        }
+    }
+    if (sock->is_registered) {
+        activate_socket(shard, sock);
+    }
+}
+
+/**
+ * Handles the completions of the shard's io_uring, after waiting for one if
+ * `wait` is set and none is there.
+ *
+ * @param shard The shard owning the ring.
+ * @param wait Non-zero to wait for a completion.
+ */
+static void uring_reap(backend_shard_t* shard, int wait) {
+    struct io_uring_cqe* cqe;
+
+    if (wait && uring_peek_cqe(&(shard->uring)) == NULL &&
+        uring_submit(&(shard->uring), 1) < 0) {
+        perror("ERROR waiting for io_uring completions");
+    }
+    while ((cqe = uring_peek_cqe(&(shard->uring))) != NULL) {
+        handle_uring_cqe(shard, cqe);
+        uring_cqe_seen(&(shard->uring));
+    }
+}
+
+/**
+ * io_uring counterpart of sendmmsg(): submits one SENDMSG entry per message,
+ * without waiting for them; their completions come through the event loop.
+ * Each entry takes a copy of its message (see uring_send_t), and holds the
+ * payload in the send ring until it completes. Waits for completions only if
+ * every entry of the shard is in flight.
+ *
+ * @param sock The socket sending the messages.
+ * @param first The first message of the transmit batch to send.
+ * @param count The number of messages.
+ * @param num_msgs The number of messages of the batch.
+ */
+static void uring_send_msgs(foggy_socket_t* sock, int first, int count,
+    int num_msgs) {
+    backend_shard_t* shard = sock->shard;
+
+    for (int m = first; m < first + count; ++m) {
+        struct msghdr* msg = &(shard->gso_msgs[m].msg_hdr);
+        int last = m + 1 < num_msgs ? shard->gso_first[m + 1] :
+            shard->send_count;
+        int iov_first = shard->send_iov_first[shard->gso_first[m]];
+        struct io_uring_sqe* sqe;
+        uring_send_t* send;
+        zc_send_t zc;
+        int payload = 0;
+
+        while (shard->uring_free_sends == NULL) {
+            uring_reap(shard, 1);
+        }
+        send = shard->uring_free_sends;
+        shard->uring_free_sends = send->next_free;
+
+        send->msg = *msg;
+        send->addr = sock->conn;
+        send->msg.msg_name = &(send->addr);
+        memcpy(send->iovs, msg->msg_iov, msg->msg_iovlen * sizeof(struct iovec));
+        send->msg.msg_iov = send->iovs;
+        if (msg->msg_controllen > 0) {
+            memcpy(send->ctrl, msg->msg_control, msg->msg_controllen);
+            send->msg.msg_control = send->ctrl;
+        }
+        send->owned_count = 0;
+        for (int i = shard->gso_first[m]; i < last; ++i) {
+            struct iovec* iov = &(send->iovs[shard->send_iov_first[i] -
+                iov_first]);
+            uint8_t* hdr = send->hdrs[i - shard->gso_first[m]];
+
+            if (shard->send_owned[i] != NULL) {
+                // The entry gives the packet back to the pool instead.
+                send->owned[send->owned_count++] = shard->send_owned[i];
+                shard->send_owned[i] = NULL;
+                continue;
+            }
+            // A segment of the send window: its header, then its payload in
+            // the send ring.
+            uint32_t seq = get_seq((foggy_tcp_header_t*)iov->iov_base);
+            memcpy(hdr, iov->iov_base, iov->iov_len);
+            iov->iov_base = hdr;
+            if (!payload || before(seq, zc.first_seq)) {
+                zc.first_seq = seq;
             }
+            payload = 1;
+        }
+        send->sock = sock;
+        send->pending = NULL;
+        if (payload) {
+            zc.id = 0;
+            zc.hdr_end = sock->zc_hdr_tail;
+            zc.done = 0;
+            // References to the elements of a deque survive push_back().
+            sock->zc_pending.push_back(zc);
+            send->pending = &(sock->zc_pending.back());
+        }
+
+        while ((sqe = uring_get_sqe(&(shard->uring))) == NULL) {
+            uring_reap(shard, 1);
         }
-        // ------------------------------------------------------------------
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = sock->socket;
+        sqe->addr = (uint64_t)(uintptr_t)&(send->msg);
+        sqe->user_data = (uint64_t)(uintptr_t)send | URING_TAG_SEND;
+        sock->uring_sends++;
+    }
+    // If this fails, the entries stay in the submission queue and leave with
+    // the next submission; they own everything they point to.
+    if (uring_submit(&(shard->uring), 0) < 0) {
+        perror("ERROR submitting io_uring sends");
+    }
+}
+
+/**
+ * Tells if a message of the transmit batch should be sent with MSG_ZEROCOPY:
+ * it must be large, made of segments of the send ring only, and its headers
+ * must fit in the free header slots of the socket.
+ *
+ * @param sock The socket sending the batch.
+ * @param m The message.
+ * @param num_msgs The number of messages of the batch.
+ * @param hdr_tail The first free header slot.
+ */
+static int zerocopy_eligible(foggy_socket_t* sock, int m, int num_msgs,
+    uint32_t hdr_tail) {
+    backend_shard_t* shard = sock->shard;
+    int last = m + 1 < num_msgs ? shard->gso_first[m + 1] : shard->send_count;
+    uint32_t bytes = 0;
+
+    if (!sock->zc_enabled || sock->io_engine != FOGGY_IO_SYSCALL ||
+        hdr_tail - sock->zc_hdr_head + (last - shard->gso_first[m]) >
+        ZEROCOPY_HDR_SLOTS) {
+        return 0;
+    }
+    for (int i = shard->gso_first[m]; i < last; ++i) {
+        if (shard->send_owned[i] != NULL ||
+            shard->send_iovs[shard->send_iov_first[i]].iov_len >
+            ZEROCOPY_HDR_SIZE) {
+            return 0;
+        }
+        bytes += shard->send_len[i];
+    }
+    return bytes >= ZEROCOPY_MIN_BYTES;
+}
 
+/**
+ * Prepares a message for MSG_ZEROCOPY. The payload stays in the send ring,
+ * which keeps it until the send completes, but the headers are refreshed on
+ * retransmission and die with their slot of the send window: the message
+ * sends copies of them instead.
+ *
+ * @param sock The socket sending the batch.
+ * @param m The message.
+ * @param num_msgs The number of messages of the batch.
+ * @param hdr_tail The first free header slot; advanced past the copies.
+ * @param zc The send to fill: the oldest sequence number of the message and
+ *           the end of its header slots.
+ */
+static void zerocopy_stage(foggy_socket_t* sock, int m, int num_msgs,
+    uint32_t* hdr_tail, zc_send_t* zc) {
+    backend_shard_t* shard = sock->shard;
+    int last = m + 1 < num_msgs ? shard->gso_first[m + 1] : shard->send_count;
 
-        while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    zc->first_seq = 0;
+    for (int i = shard->gso_first[m]; i < last; ++i) {
+        struct iovec* iov = &(shard->send_iovs[shard->send_iov_first[i]]);
+        uint8_t* copy = sock->zc_hdrs +
+            (*hdr_tail % ZEROCOPY_HDR_SLOTS) * ZEROCOPY_HDR_SIZE;
+        uint32_t seq = get_seq((foggy_tcp_header_t*)iov->iov_base);
+
+        memcpy(copy, iov->iov_base, iov->iov_len);
+        iov->iov_base = copy;
+        (*hdr_tail)++;
+        if (i == shard->gso_first[m] || before(seq, zc->first_seq)) {
+            zc->first_seq = seq;
         }
-        buf_len = sock->sending_len;
+    }
+    zc->hdr_end = *hdr_tail;
+    zc->done = 0;
+}
 
-        if (!sock->send_window.empty()) {
-            // printf("Sending window is not empty\n");
-            send_pkts(sock, NULL, 0); // Tente d'envoyer les paquets en attente
-            check_for_pkt(sock, NO_WAIT);
+void flush_pkts(foggy_socket_t* sock) {
+    backend_shard_t* shard;
+    int sent = 0, num_msgs, staged = 0, run, n, i;
+    // Per message: sent with MSG_ZEROCOPY, and the matching send.
+    char zc_msg[BACKEND_SEND_BATCH];
+    zc_send_t zc_sends[BACKEND_SEND_BATCH];
+    uint32_t hdr_tail;
+
+    if (sock == NULL || sock->shard->send_sock != sock) {
+        return;
+    }
+    shard = sock->shard;
+    hdr_tail = sock->zc_hdr_tail;
+
+    // Every segment has its own header, so a zero-copy message quickly
+    // reaches the fragment limit of the kernel; keep runs below it.
+    num_msgs = build_send_msgs(shard, 0, sock->gso_enabled,
+        sock->zc_enabled && sock->io_engine == FOGGY_IO_SYSCALL ?
+        ZEROCOPY_MAX_FRAGS : 0);
+    while (sent < num_msgs) {
+        // Large messages leave with MSG_ZEROCOPY and the others are copied;
+        // one call sends a run of messages of the same kind.
+        for (run = 0; sent + run < num_msgs; ++run) {
+            int m = sent + run;
+            if (m == staged) {
+                zc_msg[m] = zerocopy_eligible(sock, m, num_msgs, hdr_tail);
+                if (zc_msg[m]) {
+                    zerocopy_stage(sock, m, num_msgs, &hdr_tail, &zc_sends[m]);
+                }
+                ++staged;
+            }
+            if (zc_msg[m] != zc_msg[sent]) {
+                break;
+            }
         }
 
-        if (death && buf_len == 0 && sock->send_window.empty()) {
+        if (sock->io_engine == FOGGY_IO_URING) {
+            // Failures are reported by the completions.
+            uring_send_msgs(sock, sent, run, num_msgs);
+            n = run;
+        }
+        else {
+            n = sendmmsg(sock->socket, shard->gso_msgs + sent, run,
+                zc_msg[sent] ? MSG_ZEROCOPY : 0);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (zc_msg[sent] && errno == ENOBUFS) {
+                // Out of memory to track the pinned pages: copy this run.
+                for (i = sent; i < sent + run; ++i) {
+                    zc_msg[i] = 0;
+                }
+                continue;
+            }
+            if (sock->gso_enabled && (errno == EIO || errno == EINVAL)) {
+                // The kernel or the device cannot segment: quietly fall
+                // back to one datagram per packet for this socket.
+                sock->gso_enabled = 0;
+                num_msgs = build_send_msgs(shard, shard->gso_first[sent], 0,
+                    0);
+                // Single datagrams are too small for zero-copy; the header
+                // copies already made are simply sent by copy.
+                memset(zc_msg, 0, sizeof(zc_msg));
+                sent = 0;
+                staged = num_msgs;
+                continue;
+            }
+            // Whatever was not handed to the kernel is recovered by the
+            // retransmission timer, like any other lost datagram.
+            perror("ERROR sending packets");
             break;
         }
+        if (zc_msg[sent]) {
+            // The kernel numbers the zero-copy sends of the socket in order.
+            for (i = sent; i < sent + n; ++i) {
+                zc_sends[i].id = sock->zc_next_id++;
+                sock->zc_pending.push_back(zc_sends[i]);
+                sock->zc_hdr_tail = zc_sends[i].hdr_end;
+            }
+        }
+        sent += n;
+    }
+
+    for (i = 0; i < shard->send_count; ++i) {
+        if (shard->send_owned[i] != NULL) {
+            pool_put(&(shard->pool), shard->send_owned[i]);
+        }
+    }
+    shard->send_count = 0;
+    shard->send_sock = NULL;
+}
 
-        if (buf_len > 0) {
+void set_zerocopy(foggy_socket_t* sock, int enable) {
+    int one = 1;
 
-            data = (uint8_t*)malloc(buf_len);
-            memcpy(data, sock->sending_buf, buf_len);
-            sock->sending_len = 0;
-            free(sock->sending_buf);
-            sock->sending_buf = NULL;
-            pthread_mutex_unlock(&(sock->send_lock));
-            send_pkts(sock, data, buf_len);
-            free(data);
+    if (!enable) {
+        sock->zc_enabled = 0;
+        return;
+    }
+    // The header slots are only released with the socket. Page alignment
+    // keeps each slot within one page fragment.
+    if (sock->zc_hdrs == NULL) {
+        sock->zc_hdrs = (uint8_t*)aligned_alloc(ZEROCOPY_PAGE_SIZE,
+            ZEROCOPY_HDR_SLOTS * ZEROCOPY_HDR_SIZE);
+        if (sock->zc_hdrs == NULL) {
+            return;
         }
-        else {
-            pthread_mutex_unlock(&(sock->send_lock));
+    }
+    // Once enabled on the UDP socket, SO_ZEROCOPY stays on: it has no effect
+    // on sends without MSG_ZEROCOPY.
+    sock->zc_enabled = setsockopt(sock->socket, SOL_SOCKET, SO_ZEROCOPY, &one,
+        sizeof(one)) == 0;
+}
+
+/**
+ * Reads the completions of zero-copy sends from the error queue of the
+ * socket, then releases the header slots and the bytes of the send ring the
+ * kernel no longer references. The io_uring engine marks its sends done as
+ * their completions arrive.
+ *
+ * @param sock The socket with zero-copy or io_uring sends in flight.
+ */
+static void reap_zerocopy(foggy_socket_t* sock) {
+    char ctrl[BACKEND_CMSG_SIZE];
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+
+    while (sock->io_engine == FOGGY_IO_SYSCALL && !sock->zc_pending.empty()) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        if (recvmsg(sock->socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("ERROR reading zero-copy completions");
+            }
+            break;
         }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+            cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err err;
 
-        check_for_pkt(sock, NO_WAIT);
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // Sends ee_info to ee_data (inclusive) completed.
+            for (size_t i = 0; i < sock->zc_pending.size(); ++i) {
+                zc_send_t& zc = sock->zc_pending[i];
+                if (zc.id - err.ee_info <= err.ee_data - err.ee_info) {
+                    zc.done = 1;
+                }
+            }
+            // The kernel had to copy the data after all: pinning pages only
+            // costs more, as is the case for loopback traffic.
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                sock->zc_enabled = 0;
+            }
+        }
+    }
+
+    while (!sock->zc_pending.empty() && sock->zc_pending.front().done) {
+        sock->zc_hdr_head = sock->zc_pending.front().hdr_end;
+        sock->zc_pending.pop_front();
+    }
+    release_send_ring(sock);
+}
+
+void set_udp_offload(foggy_socket_t* sock, int enable) {
+    int gso_size = 0;
+
+    // UDP_SEGMENT is only probed here (a size of 0 keeps per-message
+    // segmentation); the segment size is given with each sendmmsg().
+    sock->gso_enabled = enable &&
+        setsockopt(sock->socket, SOL_UDP, UDP_SEGMENT, &gso_size,
+            sizeof(gso_size)) == 0;
+    sock->gro_enabled = setsockopt(sock->socket, SOL_UDP, UDP_GRO, &enable,
+        sizeof(enable)) == 0 && enable;
+}
 
-        while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+/**
+ * The process-wide backend engine. Every socket is owned by exactly one
+ * shard, and each shard runs one event loop thread for all its sockets.
+ */
+static backend_shard_t backend_shards[BACKEND_MAX_THREADS];
+static int backend_num_threads = BACKEND_DEFAULT_THREADS;
+static int backend_started = 0;
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+static unsigned int backend_next_shard = 0;
+
+/**
+ * Creates the event loop of every shard and launches its thread.
+ */
+static void start_backend_engine() {
+    struct epoll_event ev;
+
+    __atomic_store_n(&backend_started, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < backend_num_threads; ++i) {
+        backend_shard_t* shard = &backend_shards[i];
+        shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        shard->timer_fd =
+            timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        shard->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->epoll_fd < 0 || shard->timer_fd < 0 || shard->event_fd < 0) {
+            perror("ERROR creating backend event loop");
+            exit(EXIT_FAILURE);
         }
+        shard->mailbox = NULL;
+        pool_init(&(shard->pool));
+        shard->uring_state = 0;
 
-        send_signal = sock->received_len > 0;
+        // Receive buffers are set up once and reused by every recvmmsg().
+        // They are large enough for a datagram coalesced by UDP GRO.
+        shard->recv_bufs =
+            (uint8_t*)malloc(BACKEND_RECV_BATCH * BACKEND_RECV_BUF_SIZE);
+        if (shard->recv_bufs == NULL) {
+            perror("ERROR allocating receive buffers");
+            exit(EXIT_FAILURE);
+        }
+        for (int j = 0; j < BACKEND_RECV_BATCH; ++j) {
+            struct msghdr* hdr = &(shard->recv_msgs[j].msg_hdr);
+            memset(hdr, 0, sizeof(*hdr));
+            shard->recv_iovs[j].iov_base =
+                shard->recv_bufs + j * BACKEND_RECV_BUF_SIZE;
+            shard->recv_iovs[j].iov_len = BACKEND_RECV_BUF_SIZE;
+            hdr->msg_name = &(shard->recv_addrs[j]);
+            hdr->msg_namelen = sizeof(struct sockaddr_in);
+            hdr->msg_iov = &(shard->recv_iovs[j]);
+            hdr->msg_iovlen = 1;
+            hdr->msg_control = shard->recv_ctrl[j];
+            hdr->msg_controllen = BACKEND_CMSG_SIZE;
+        }
+        shard->send_count = 0;
+        shard->send_iov_first[0] = 0;
+        shard->send_sock = NULL;
+
+        // The shard's own descriptors are told apart from the sockets by the
+        // address stored in the event data.
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &(shard->timer_fd);
+        epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->timer_fd, &ev);
+        ev.data.ptr = &(shard->event_fd);
+        epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->event_fd, &ev);
+
+        pthread_create(&(shard->thread_id), NULL, begin_backend, (void*)shard);
+    }
+}
+
+int backend_set_num_threads(int num_threads) {
+    if (num_threads < 1 || num_threads > BACKEND_MAX_THREADS) {
+        return EXIT_ERROR;
+    }
+    if (__atomic_load_n(&backend_started, __ATOMIC_ACQUIRE)) {
+        return EXIT_ERROR;
+    }
+    backend_num_threads = num_threads;
+    return EXIT_SUCCESS;
+}
+
+void backend_register(foggy_socket_t* sock) {
+    pthread_once(&backend_once, start_backend_engine);
+
+    // Sockets are spread round-robin; from now on only the owning shard
+    // touches their window, send_window and receive_window.
+    sock->shard = &backend_shards[__atomic_fetch_add(&backend_next_shard, 1,
+        __ATOMIC_RELAXED) % backend_num_threads];
+    sock->kicked = 0;
+    sock->is_registered = 0;
+    sock->is_active = 0;
+    sock->closed = 0;
+    sock->timer_deadline = 0;
+    sock->timer_index = -1;
+    sock->uring_sends = 0;
+
+    // The shard picks the socket up from its mailbox and adds it to its
+    // connection table; only the shard thread touches that table.
+    notify_backend(sock);
+}
+
+/**
+ * Wakes up the backend of a socket.
+ *
+ * Called by the application side (`foggy_write`, `foggy_close`) whenever it
+ * hands new work to the backend, so the backend does not have to poll. The
+ * socket is pushed on the shard's mailbox unless it is already queued, and
+ * the shard's eventfd is only written when the mailbox was empty: the shard
+ * is then about to take the whole mailbox anyway.
+ *
+ * @param sock The socket whose backend should be woken up.
+ */
+void notify_backend(foggy_socket_t* sock) {
+    backend_shard_t* shard = sock->shard;
+    foggy_socket_t* head;
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&(sock->kicked), 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    head = __atomic_load_n(&(shard->mailbox), __ATOMIC_RELAXED);
+    do {
+        sock->mailbox_next = head;
+    } while (!__atomic_compare_exchange_n(&(shard->mailbox), &head, sock, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (head != NULL) {
+        return;
+    }
+
+    if (write(shard->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("ERROR notifying backend");
+    }
+}
+
+/* Min-heap of the sockets with a running timer, keyed on timer_deadline. */
+
+static void timer_heap_swap(backend_shard_t* shard, int i, int j) {
+    foggy_socket_t* tmp = shard->timers[i];
+    shard->timers[i] = shard->timers[j];
+    shard->timers[j] = tmp;
+    shard->timers[i]->timer_index = i;
+    shard->timers[j]->timer_index = j;
+}
 
-        pthread_mutex_unlock(&(sock->recv_lock));
+static void timer_heap_sift(backend_shard_t* shard, int i) {
+    int n = shard->timers.size();
 
-        if (send_signal) {
-            pthread_cond_signal(&(sock->wait_cond));
+    while (i > 0 && shard->timers[(i - 1) / 2]->timer_deadline >
+        shard->timers[i]->timer_deadline) {
+        timer_heap_swap(shard, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < n && shard->timers[left]->timer_deadline <
+            shard->timers[smallest]->timer_deadline) {
+            smallest = left;
+        }
+        if (right < n && shard->timers[right]->timer_deadline <
+            shard->timers[smallest]->timer_deadline) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        timer_heap_swap(shard, i, smallest);
+        i = smallest;
+    }
+}
+
+static void timer_heap_remove(backend_shard_t* shard, foggy_socket_t* sock) {
+    int i = sock->timer_index;
+    if (i < 0) {
+        return;
+    }
+    timer_heap_swap(shard, i, shard->timers.size() - 1);
+    shard->timers.pop_back();
+    sock->timer_index = -1;
+    if (i < (int)shard->timers.size()) {
+        timer_heap_sift(shard, i);
+    }
+}
+
+/**
+ * Tells if something the socket sent awaits an acknowledgement: segments of
+ * the send window, or its SYN.
+ */
+static int awaits_ack(foggy_socket_t* sock) {
+    return !swnd_empty(&(sock->send_window)) ||
+        sock->state == TCP_SYN_SENT || sock->state == TCP_SYN_RCVD;
+}
+
+/**
+ * Moves the socket in the shard's timer heap to its retransmission deadline
+ * or the end of its pacing delay, whichever comes first, or takes it out of
+ * the heap if neither is pending.
+ *
+ * @param sock The socket whose timer is updated.
+ */
+static void update_socket_timer(foggy_socket_t* sock) {
+    backend_shard_t* shard = sock->shard;
+
+    if (sock->window.retransmit_timeout > 0 && awaits_ack(sock)) {
+        sock->timer_deadline =
+            (int64_t)sock->window.last_send_time.tv_sec * 1000000000 +
+            sock->window.last_send_time.tv_nsec +
+            (int64_t)sock->window.retransmit_timeout * 1000000;
+    }
+    else {
+        sock->timer_deadline = 0;
+    }
+    // Segments held back by pacing leave at the next burst.
+    if (sock->pacing_wait && !swnd_empty(&(sock->send_window)) &&
+        (sock->timer_deadline == 0 ||
+        sock->pacing_next < sock->timer_deadline)) {
+        sock->timer_deadline = sock->pacing_next;
+    }
+
+    if (sock->timer_deadline == 0) {
+        timer_heap_remove(shard, sock);
+    }
+    else if (sock->timer_index < 0) {
+        sock->timer_index = shard->timers.size();
+        shard->timers.push_back(sock);
+        timer_heap_sift(shard, sock->timer_index);
+    }
+    else {
+        timer_heap_sift(shard, sock->timer_index);
+    }
+}
+
+/**
+ * Arms the shard's timerfd to the earliest deadline in its timer heap, or
+ * disarms it if the heap is empty.
+ *
+ * @param shard The shard whose timerfd is armed.
+ */
+static void arm_backend_timer(backend_shard_t* shard) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+
+    if (!shard->timers.empty()) {
+        int64_t deadline = shard->timers[0]->timer_deadline;
+        its.it_value.tv_sec = deadline / 1000000000;
+        its.it_value.tv_nsec = deadline % 1000000000;
+    }
+    if (timerfd_settime(shard->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("ERROR arming retransmission timer");
+    }
+}
+
+/**
+ * Sets up the shard's io_uring the first time a socket uses that engine, and
+ * adds the ring to the shard's event loop.
+ *
+ * @param shard The shard.
+ *
+ * @return 0 if the ring is usable, -1 if the kernel does not support it.
+ */
+static int start_shard_uring(backend_shard_t* shard) {
+    struct epoll_event ev;
+
+    if (shard->uring_state == 0) {
+        shard->uring_state = -1;
+        shard->uring_send_slots = (uring_send_t*)malloc(URING_SEND_SLOTS *
+            sizeof(uring_send_t));
+        if (shard->uring_send_slots == NULL) {
+            perror("ERROR allocating io_uring sends");
+            return -1;
+        }
+        shard->uring_free_sends = NULL;
+        for (int i = 0; i < URING_SEND_SLOTS; ++i) {
+            shard->uring_send_slots[i].next_free = shard->uring_free_sends;
+            shard->uring_free_sends = &(shard->uring_send_slots[i]);
         }
+        if (uring_init(&(shard->uring), URING_ENTRIES, URING_BUF_COUNT,
+            sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) +
+            BACKEND_CMSG_SIZE + BACKEND_RECV_BUF_SIZE) == 0) {
+            memset(&(shard->uring_recv_hdr), 0, sizeof(shard->uring_recv_hdr));
+            shard->uring_recv_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            shard->uring_recv_hdr.msg_controllen = BACKEND_CMSG_SIZE;
 
-        usleep(1000); // Dlai de 1ms pour rduire la charge CPU et laisser le temps au timer d'avancer
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = &(shard->uring);
+            if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->uring.ring_fd,
+                &ev) == 0) {
+                shard->uring_state = 1;
+            }
+        }
+    }
+    return shard->uring_state == 1 ? 0 : -1;
+}
+
+/**
+ * Adds the socket to the shard's connection table and event loop.
+ *
+ * @param sock The newly created socket.
+ */
+static void attach_socket(foggy_socket_t* sock) {
+    backend_shard_t* shard = sock->shard;
+    struct epoll_event ev;
+
+    if (sock->io_engine == FOGGY_IO_URING && start_shard_uring(shard) == 0) {
+        sock->conn_index = shard->connections.size();
+        shard->connections.push_back(sock);
+        sock->is_registered = 1;
+        uring_arm_recv(sock);
+        return;
+    }
+    // Without io_uring support, quietly use the system call engine.
+    sock->io_engine = FOGGY_IO_SYSCALL;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = sock;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, sock->socket, &ev) < 0) {
+        perror("ERROR registering socket with the backend");
+    }
+    sock->conn_index = shard->connections.size();
+    shard->connections.push_back(sock);
+    sock->is_registered = 1;
+}
+
+/**
+ * Removes a closing socket from the shard and wakes up `foggy_close`. The
+ * backend must not touch the socket after this.
+ *
+ * @param sock The socket whose transfer is complete.
+ */
+static void detach_socket(foggy_socket_t* sock) {
+    backend_shard_t* shard = sock->shard;
+    foggy_socket_t* last = shard->connections.back();
+
+    if (sock->io_engine == FOGGY_IO_URING) {
+        struct io_uring_sqe* sqe = uring_get_sqe(&(shard->uring));
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t)(uintptr_t)sock | URING_TAG_RECV;
+            sqe->user_data = URING_TAG_CANCEL;
+            uring_submit(&(shard->uring), 0);
+        }
+        while (!sock->uring_pending.empty()) {
+            uring_recycle_buf(&(shard->uring),
+                sock->uring_pending.front() >> 32);
+            sock->uring_pending.pop_front();
+        }
+    }
+    else {
+        epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, sock->socket, NULL);
+    }
+    timer_heap_remove(shard, sock);
+    sock->is_registered = 0;
+    free(sock->zc_hdrs);
+    sock->zc_hdrs = NULL;
+    shard->connections[sock->conn_index] = last;
+    last->conn_index = sock->conn_index;
+    shard->connections.pop_back();
+
+    // The socket is not freed by foggy_close(), so waking it up after the
+    // store is safe.
+    __atomic_store_n(&(sock->closed), 1, __ATOMIC_RELEASE);
+    futex_wake(&(sock->closed));
+}
+
+/**
+ * Cuts the data written by the application into segments of the send
+ * window, no more than the window has room for. The segments point into the
+ * send ring, which keeps the bytes until they are acknowledged; what does not
+ * fit in the window waits in the ring, so a fast writer is held back by the
+ * ring capacity.
+ *
+ * @param sock The socket whose data is sent.
+ */
+static void pull_send_ring(foggy_socket_t* sock) {
+    uint32_t room, len, queued;
+
+    while ((room = send_window_room(sock)) > 0) {
+        // Pairs with the fence in foggy_write(): either we see the data
+        // written once we had caught up, or the writer notifies us.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        queued = sock->window.next_seq_num - sock->send_ring_seq;
+        len = ring_used(&(sock->send_ring)) - queued;
+        if (len == 0) {
+            break;
+        }
+        // Keep segments full-sized when the window is the limit.
+        if (len > room) {
+            len = room >= MSS ? room - room % MSS : room;
+        }
+        send_pkts(sock, len);
+        len = sock->window.next_seq_num - sock->send_ring_seq - queued;
+        __atomic_store_n(&(sock->send_pulled),
+            sock->send_ring.head + queued + len, __ATOMIC_RELEASE);
+        // The send window could not grow.
+        if (len == 0) {
+            break;
+        }
+    }
+}
+
+void release_send_ring(foggy_socket_t* sock) {
+    // Everything before the oldest unacknowledged segment was acknowledged.
+    uint32_t end = swnd_empty(&(sock->send_window)) ?
+        sock->window.next_seq_num : swnd_front(&(sock->send_window))->seq;
+
+    for (size_t i = 0; i < sock->zc_pending.size(); ++i) {
+        if (before(sock->zc_pending[i].first_seq, end)) {
+            end = sock->zc_pending[i].first_seq;
+        }
+    }
+    if (!after(end, sock->send_ring_seq)) {
+        return;
+    }
+    ring_consume(&(sock->send_ring), end - sock->send_ring_seq);
+    sock->send_ring_seq = end;
+
+    ring_wake_writer(&(sock->send_ring));
+}
+
+/**
+ * Runs one round of protocol processing for a socket that had an event:
+ * incoming packets, retransmission timeout, new application data, and
+ * closing once everything was acknowledged.
+ *
+ * @param sock The socket to process.
+ */
+static void process_socket(foggy_socket_t* sock) {
+    int death;
+    long current_time_ms, last_send_time_ms, elapsed_time_ms;
+
+    death = __atomic_load_n(&(sock->dying), __ATOMIC_ACQUIRE);
+
+    // Completions of zero-copy sends come in on the error queue (EPOLLERR),
+    // those of io_uring sends in the completion queue.
+    if (!sock->zc_pending.empty()) {
+        reap_zerocopy(sock);
+    }
+
+    // foggy_set_congestion_control() picked another algorithm.
+    if (__atomic_load_n(&(sock->cc_request), __ATOMIC_RELAXED) != NULL) {
+        cc_init(sock, __atomic_exchange_n(&(sock->cc_request),
+            (const cc_ops_t*)NULL, __ATOMIC_ACQUIRE));
+    }
+
+    // Drain the socket; a partial batch means it is empty.
+    while (check_for_pkt(sock, NO_WAIT) == BACKEND_RECV_BATCH) {
+    }
+
+    // ------------------------------------------------------------------
+    // NOUVELLE LOGIQUE: VRIFICATION ET GESTION DU TIMER DE RETRANSMISSION
+    // Only once the socket is drained: if the thread ran late, the ACKs that
+    // restart the timer may be waiting there, and the RTO is now short
+    // enough for such a delay to fire it spuriously.
+    // ------------------------------------------------------------------
+    if (sock->window.retransmit_timeout > 0 && awaits_ack(sock)) {
+
+        current_time_ms = get_time_in_ms();
+
+        // Convertir le temps de dpart struct timespec en ms
+        last_send_time_ms = sock->window.last_send_time.tv_sec * 1000 +
+            sock->window.last_send_time.tv_nsec / 1000000;
+
+        elapsed_time_ms = current_time_ms - last_send_time_ms;
+
+        // Si le temps coul est suprieur ou gal au RTO
+        if (elapsed_time_ms >= sock->window.retransmit_timeout) {
+            // Timeout dtect! Le timer doit tre gr sous lock si ncessaire, 
+            // mais l'appel  on_retransmit_timer() le gre dj.
+            on_retransmit_timer(sock);
+        }
+    }
+    // ------------------------------------------------------------------
+
+    // A new initiator opens the connection; on_retransmit_timer() sends the
+    // SYN again if it gets no answer.
+    if (sock->state == TCP_SYN_SENT && sock->window.retransmit_timeout == 0) {
+        send_syn(sock);
+    }
+
+    // The application read enough to reopen our receive window: tell the
+    // peer, which may be waiting for it.
+    if (__atomic_exchange_n(&(sock->window_update), 0, __ATOMIC_ACQ_REL)) {
+        send_ack(sock);
+    }
+
+    // Take new data once the ACKs are in, so it can use the room they made.
+    pull_send_ring(sock);
+
+    // Wake foggy_read() if it sleeps on an empty receive ring; one system
+    // call at most per round, none if the application is busy.
+    ring_wake_reader(&(sock->recv_ring));
+
+    // ACKs may have opened the window while draining the socket.
+    if (!swnd_empty(&(sock->send_window))) {
+        transmit_send_window(sock);
+    }
+
+    // Data segments and the ACKs generated while draining the socket leave
+    // together in one sendmmsg().
+    flush_pkts(sock);
+
+    // foggy_write() cannot be called once the socket is dying, so the send
+    // ring only empties and the socket can leave the shard once all is acked.
+    if (death && ring_used(&(sock->send_ring)) == 0 &&
+        swnd_empty(&(sock->send_window))) {
+        detach_socket(sock);
+        return;
+    }
+
+    update_socket_timer(sock);
+}
+
+/**
+ * Marks a socket as needing a round of processing in this loop iteration.
+ */
+static void activate_socket(backend_shard_t* shard, foggy_socket_t* sock) {
+    if (!sock->is_active) {
+        sock->is_active = 1;
+        shard->active.push_back(sock);
+    }
+}
+
+void* begin_backend(void* in) {
+    backend_shard_t* shard = (backend_shard_t*)in;
+    uint64_t counter;
+    int i, nfds;
+    struct epoll_event events[BACKEND_MAX_EVENTS];
+    foggy_socket_t *mailbox, *next;
+
+    while (1) {
+        arm_backend_timer(shard);
+
+        nfds = epoll_wait(shard->epoll_fd, events, BACKEND_MAX_EVENTS, -1);
+        if (nfds < 0) {
+            if (errno != EINTR) {
+                perror("ERROR waiting for backend events");
+            }
+            continue;
+        }
+
+        for (i = 0; i < nfds; ++i) {
+            void* source = events[i].data.ptr;
+
+            if (source == &(shard->timer_fd)) {
+                // Every socket whose deadline passed gets processed; the
+                // timeout itself is detected by process_socket().
+                if (read(shard->timer_fd, &counter, sizeof(counter)) < 0 &&
+                    errno != EAGAIN) {
+                    perror("ERROR reading backend timer");
+                }
+                int64_t now = get_time_in_ns();
+                while (!shard->timers.empty() &&
+                    shard->timers[0]->timer_deadline <= now) {
+                    foggy_socket_t* sock = shard->timers[0];
+                    timer_heap_remove(shard, sock);
+                    activate_socket(shard, sock);
+                }
+            }
+            else if (source == &(shard->uring)) {
+                uring_reap(shard, 0);
+            }
+            else if (source == &(shard->event_fd)) {
+                if (read(shard->event_fd, &counter, sizeof(counter)) < 0 &&
+                    errno != EAGAIN) {
+                    perror("ERROR reading backend event");
+                }
+                // Take the whole mailbox; it is a stack, so reverse it to
+                // serve the sockets in the order they were kicked.
+                mailbox = NULL;
+                for (foggy_socket_t* sock = __atomic_exchange_n(
+                    &(shard->mailbox), (foggy_socket_t*)NULL, __ATOMIC_ACQUIRE);
+                    sock != NULL; sock = next) {
+                    next = sock->mailbox_next;
+                    sock->mailbox_next = mailbox;
+                    mailbox = sock;
+                }
+                for (foggy_socket_t* sock = mailbox; sock != NULL; sock = next) {
+                    // Once `kicked` is cleared the socket may be pushed
+                    // again, which overwrites mailbox_next.
+                    next = sock->mailbox_next;
+                    __atomic_store_n(&(sock->kicked), 0, __ATOMIC_RELEASE);
+                    if (!sock->is_registered) {
+                        attach_socket(sock);
+                    }
+                    activate_socket(shard, sock);
+                }
+            }
+            else {
+                activate_socket(shard, (foggy_socket_t*)source);
+            }
+        }
+
+        for (size_t j = 0; j < shard->active.size(); ++j) {
+            foggy_socket_t* sock = shard->active[j];
+            sock->is_active = 0;
+            process_socket(sock);
+        }
+        shard->active.clear();
     }
 
-    pthread_exit(NULL);
     return NULL;
 }
 
@@ -203,14 +1476,14 @@ void* begin_backend(void* in) {
  * Dmarre le timer de retransmission pour le paquet SendBase.
  */
 void start_retransmit_timer(foggy_socket_t* sock) {
-    // Si la fentre est vide, pas besoin de timer.
-    if (sock->send_window.empty()) {
+    // Si rien n'attend d'acquittement, pas besoin de timer.
+    if (!awaits_ack(sock)) {
         stop_retransmit_timer(sock);
         return;
     }
 
-    // Le RTO_INITIAL est dj dfini dans foggy_function.h
-    sock->window.retransmit_timeout = RTO_INITIAL;
+    // Le RTO suit le chemin (voir update_rtt() dans foggy_function.cc).
+    sock->window.retransmit_timeout = sock->window.rto;
 
     // Enregistre le temps actuel.
     struct timespec current_time;
@@ -0,0 +1,99 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the registry of the congestion control algorithms,
+ * and the calls to their hooks.
+ */
+
+#include "foggy_cc.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "foggy_tcp.h"
+
+static const cc_ops_t* cc_algorithms[CC_MAX_ALGORITHMS] = {
+    &cc_reno,
+    &cc_cubic,
+    &cc_bbr,
+};
+static int cc_count = 3;
+static pthread_mutex_t cc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int cc_register(const cc_ops_t* ops) {
+    int ret = -1;
+
+    if ((ops->on_ack == NULL && ops->cong_control == NULL) ||
+        ops->on_loss == NULL || ops->on_rto == NULL || ops->cwnd == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&cc_lock);
+    if (cc_count < CC_MAX_ALGORITHMS && cc_find(ops->name) == NULL) {
+        // Readers do not lock: publish the entry before the count.
+        cc_algorithms[cc_count] = ops;
+        __atomic_store_n(&cc_count, cc_count + 1, __ATOMIC_RELEASE);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&cc_lock);
+    return ret;
+}
+
+const cc_ops_t* cc_find(const char* name) {
+    int count = __atomic_load_n(&cc_count, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; ++i) {
+        if (strncmp(cc_algorithms[i]->name, name, CC_NAME_MAX) == 0) {
+            return cc_algorithms[i];
+        }
+    }
+    return NULL;
+}
+
+void cc_init(foggy_socket_t* sock, const cc_ops_t* ops) {
+    sock->cc = ops;
+    memset(sock->cc_priv, 0, sizeof(sock->cc_priv));
+    if (ops->init != NULL) {
+        ops->init(sock);
+    }
+}
+
+void cc_on_ack(foggy_socket_t* sock, uint32_t acked, int64_t rtt) {
+    if (sock->cc->on_ack != NULL) {
+        sock->cc->on_ack(sock, acked, rtt);
+    }
+}
+
+void cc_on_loss(foggy_socket_t* sock) {
+    sock->cc->on_loss(sock);
+}
+
+void cc_on_rto(foggy_socket_t* sock) {
+    sock->cc->on_rto(sock);
+}
+
+void cc_on_send(foggy_socket_t* sock, uint32_t bytes) {
+    if (sock->cc->on_send != NULL) {
+        sock->cc->on_send(sock, bytes);
+    }
+}
+
+uint32_t cc_cwnd(foggy_socket_t* sock) {
+    return sock->cc->cwnd(sock);
+}
+
+uint64_t cc_pacing_rate(foggy_socket_t* sock) {
+    return sock->cc->pacing_rate != NULL ? sock->cc->pacing_rate(sock) : 0;
+}
+
+void cc_cong_control(foggy_socket_t* sock, const swnd_rate_sample_t* rs) {
+    if (sock->cc->cong_control != NULL) {
+        sock->cc->cong_control(sock, rs);
+    }
+}
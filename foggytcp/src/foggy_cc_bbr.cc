@@ -0,0 +1,476 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements BBR (version 1, draft-cardwell-iccrg-bbr-congestion-
+ * control-00). Instead of reacting to losses, BBR models the path with two
+ * estimates: the bottleneck bandwidth, the maximum delivery rate of the last
+ * BBR_BW_ROUNDS round trips, and the propagation delay, the minimum RTT of
+ * the last BBR_MIN_RTT_WINDOW. It paces at the bandwidth, and keeps about
+ * their product (the BDP) in flight, so that the queue of the bottleneck
+ * stays nearly empty.
+ *
+ * It runs in phases:
+ * - STARTUP doubles the rate each round trip, like slow start, until the
+ *   bandwidth stops growing for BBR_FULL_BW_ROUNDS rounds.
+ * - DRAIN paces slower until the queue STARTUP built is gone.
+ * - PROBE_BW cycles the pacing rate around the bandwidth: one RTT above to
+ *   find more, one below to drain what that queued, six at it.
+ * - PROBE_RTT drops the window to BBR_MIN_CWND for BBR_PROBE_RTT_TIME once
+ *   the minimum RTT is BBR_MIN_RTT_WINDOW old, to measure it again with the
+ *   queue drained.
+ *
+ * Gains are fixed-point, in units of BBR_UNIT. Losses only bound the window
+ * for the time of a recovery: it is held at what is in flight for a round,
+ * then grows again, and gets its value back after.
+ */
+
+#include "foggy_cc.h"
+#include "foggy_function.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define BBR_UNIT 256
+// 2/ln(2): the smallest gain that doubles the delivery rate each round.
+#define BBR_HIGH_GAIN (BBR_UNIT * 2885 / 1000 + 1)
+#define BBR_DRAIN_GAIN (BBR_UNIT * 1000 / 2885)
+#define BBR_CWND_GAIN (BBR_UNIT * 2)
+#define BBR_CYCLE_LEN 8
+// Rounds of the bandwidth filter.
+#define BBR_BW_ROUNDS 10
+// ns.
+#define BBR_MIN_RTT_WINDOW 10000000000LL
+#define BBR_PROBE_RTT_TIME 200000000
+#define BBR_MIN_CWND (4 * MSS)
+// Window before the first RTT sample.
+#define BBR_INIT_CWND (10 * MSS)
+// STARTUP ends when the bandwidth grew by less than 25% for 3 rounds.
+#define BBR_FULL_BW_GROWTH (BBR_UNIT * 5 / 4)
+#define BBR_FULL_BW_ROUNDS 3
+// Pace 1% below the bandwidth, so that the queue drains.
+#define BBR_PACING_MARGIN 1
+
+#define RTT_INFINITE INT64_MAX
+
+static const uint16_t bbr_pacing_gain[BBR_CYCLE_LEN] = {
+    BBR_UNIT * 5 / 4, BBR_UNIT * 3 / 4,
+    BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT,
+};
+
+typedef enum {
+    BBR_STARTUP = 0,
+    BBR_DRAIN = 1,
+    BBR_PROBE_BW = 2,
+    BBR_PROBE_RTT = 3,
+} bbr_mode_t;
+
+typedef struct {
+    // Windowed maximum of the bandwidth in bytes/s: the best sample, and the
+    // best ones of the later parts of the window, with their rounds.
+    uint64_t bw[3];
+    uint32_t bw_round[3];
+    uint32_t round_count;
+    uint64_t next_round_delivered;  // The round ends when this is delivered.
+    uint64_t full_bw;               // Bandwidth at the last 25% growth.
+    uint64_t pacing_rate;           // bytes/s.
+    // Times are CLOCK_MONOTONIC ns.
+    int64_t min_rtt;
+    int64_t min_rtt_stamp;
+    int64_t probe_rtt_done;         // When PROBE_RTT may end, 0 before.
+    int64_t cycle_stamp;            // Start of the PROBE_BW phase.
+    uint32_t prior_cwnd;            // Window before a recovery or PROBE_RTT.
+    uint32_t recovery_end;          // The recovery ends when this is acked.
+    uint16_t pacing_gain;
+    uint16_t cwnd_gain;
+    uint8_t mode;
+    uint8_t cycle_index;
+    uint8_t full_bw_count;
+    uint8_t round_start : 1;
+    uint8_t filled_pipe : 1;
+    uint8_t in_recovery : 1;
+    uint8_t conservation : 1;       // Hold the window at what is in flight.
+    uint8_t probe_rtt_round_done : 1;
+} bbr_t;
+
+static_assert(sizeof(bbr_t) <= CC_PRIV_WORDS * sizeof(uint64_t),
+              "bbr_t does not fit in cc_priv");
+
+static bbr_t* bbr(foggy_socket_t* sock) {
+    return (bbr_t*)sock->cc_priv;
+}
+
+/**
+ * Adds a sample to the windowed maximum of the bandwidth (Kathleen Nichols'
+ * algorithm, as in Linux lib/minmax.c).
+ */
+static void bw_filter_update(bbr_t* b, uint64_t bw) {
+    uint32_t t = b->round_count;
+
+    if (bw >= b->bw[0] || t - b->bw_round[2] > BBR_BW_ROUNDS) {
+        for (int i = 0; i < 3; ++i) {
+            b->bw[i] = bw;
+            b->bw_round[i] = t;
+        }
+        return;
+    }
+    if (bw >= b->bw[1]) {
+        b->bw[2] = b->bw[1] = bw;
+        b->bw_round[2] = b->bw_round[1] = t;
+    }
+    else if (bw >= b->bw[2]) {
+        b->bw[2] = bw;
+        b->bw_round[2] = t;
+    }
+
+    // Once the best sample ages out, the next best ones take its place.
+    uint32_t dt = t - b->bw_round[0];
+    if (dt > BBR_BW_ROUNDS) {
+        for (int pass = 0; pass < 2 && t - b->bw_round[0] > BBR_BW_ROUNDS;
+             ++pass) {
+            b->bw[0] = b->bw[1];
+            b->bw_round[0] = b->bw_round[1];
+            b->bw[1] = b->bw[2];
+            b->bw_round[1] = b->bw_round[2];
+            b->bw[2] = bw;
+            b->bw_round[2] = t;
+        }
+    }
+    else if (b->bw_round[1] == b->bw_round[0] && dt > BBR_BW_ROUNDS / 4) {
+        b->bw[2] = b->bw[1] = bw;
+        b->bw_round[2] = b->bw_round[1] = t;
+    }
+    else if (b->bw_round[2] == b->bw_round[1] && dt > BBR_BW_ROUNDS / 2) {
+        b->bw[2] = bw;
+        b->bw_round[2] = t;
+    }
+}
+
+/**
+ * Returns the window that keeps `gain` times the BDP in flight, with room
+ * for the segments queued in the backend and delayed ACKs.
+ */
+static uint32_t bbr_target_cwnd(foggy_socket_t* sock, uint32_t gain) {
+    bbr_t* b = bbr(sock);
+    uint64_t bdp;
+
+    if (b->min_rtt == RTT_INFINITE) {
+        return BBR_INIT_CWND;
+    }
+    bdp = b->bw[0] * (uint64_t)b->min_rtt / 1000000000;
+    bdp = bdp * gain / BBR_UNIT + 3 * MSS;
+    return (uint32_t)MIN(MAX(bdp, (uint64_t)BBR_MIN_CWND), (uint64_t)UINT32_MAX);
+}
+
+/**
+ * Paces the first window over the first RTT, or 1 ms before any sample.
+ */
+static void bbr_init_pacing_rate(foggy_socket_t* sock) {
+    window_t* win = &(sock->window);
+    int64_t rtt = win->srtt > 0 ? win->srtt : 1000000;
+
+    bbr(sock)->pacing_rate = (uint64_t)win->congestion_window * BBR_HIGH_GAIN /
+        BBR_UNIT * 1000000000 / rtt;
+}
+
+static void bbr_set_pacing_rate(foggy_socket_t* sock) {
+    bbr_t* b = bbr(sock);
+    uint64_t rate;
+
+    if (b->bw[0] == 0) {
+        bbr_init_pacing_rate(sock);
+        return;
+    }
+    rate = b->bw[0] * b->pacing_gain / BBR_UNIT *
+        (100 - BBR_PACING_MARGIN) / 100;
+    // During STARTUP, a low sample must not slow the search down.
+    if (b->filled_pipe || rate > b->pacing_rate) {
+        b->pacing_rate = rate;
+    }
+}
+
+static void bbr_enter_probe_bw(bbr_t* b, int64_t now) {
+    b->mode = BBR_PROBE_BW;
+    // Start at a random phase, but not the one that drains.
+    b->cycle_index = (uint8_t)((2 + (now >> 10) % (BBR_CYCLE_LEN - 1)) %
+        BBR_CYCLE_LEN);
+    b->cycle_stamp = now;
+}
+
+/**
+ * Counts the round trips, and feeds the delivery rate to the bandwidth
+ * filter. A sample taken while application-limited only counts if it beats
+ * the estimate.
+ */
+static void bbr_update_bw(foggy_socket_t* sock, const swnd_rate_sample_t* rs) {
+    bbr_t* b = bbr(sock);
+    uint64_t bw;
+
+    b->round_start = 0;
+    if (rs->prior_delivered >= b->next_round_delivered) {
+        b->next_round_delivered = sock->send_window.delivered;
+        b->round_count++;
+        b->round_start = 1;
+        b->conservation = 0;
+    }
+    // An interval shorter than the RTT comes from a burst of ACKs.
+    if (rs->interval <= 0 ||
+        (b->min_rtt != RTT_INFINITE && rs->interval < b->min_rtt)) {
+        return;
+    }
+    bw = rs->delivered * 1000000000 / (uint64_t)rs->interval;
+    if (!rs->is_app_limited || bw >= b->bw[0]) {
+        bw_filter_update(b, bw);
+    }
+}
+
+/**
+ * Moves to the next PROBE_BW phase after one min RTT, or early if probing
+ * cannot fill the pipe or draining is done.
+ */
+static void bbr_update_cycle_phase(foggy_socket_t* sock,
+    const swnd_rate_sample_t* rs, int64_t now) {
+    bbr_t* b = bbr(sock);
+    uint32_t prior_inflight;
+    uint16_t gain;
+    int next;
+
+    if (b->mode != BBR_PROBE_BW) {
+        return;
+    }
+    prior_inflight = swnd_pipe(&(sock->send_window)) + rs->newly_delivered;
+    gain = bbr_pacing_gain[b->cycle_index];
+    next = now - b->cycle_stamp > b->min_rtt;
+    if (gain > BBR_UNIT) {
+        next = next && prior_inflight >= bbr_target_cwnd(sock, gain);
+    }
+    else if (gain < BBR_UNIT) {
+        next = next || prior_inflight <= bbr_target_cwnd(sock, BBR_UNIT);
+    }
+    if (next) {
+        b->cycle_index = (b->cycle_index + 1) % BBR_CYCLE_LEN;
+        b->cycle_stamp = now;
+    }
+}
+
+/**
+ * Ends STARTUP once the bandwidth stopped growing, and DRAIN once the queue
+ * it built is gone.
+ */
+static void bbr_check_full_pipe(foggy_socket_t* sock,
+    const swnd_rate_sample_t* rs, int64_t now) {
+    bbr_t* b = bbr(sock);
+
+    if (!b->filled_pipe && b->round_start && !rs->is_app_limited) {
+        if (b->bw[0] * BBR_UNIT >= b->full_bw * BBR_FULL_BW_GROWTH) {
+            b->full_bw = b->bw[0];
+            b->full_bw_count = 0;
+        }
+        else if (++b->full_bw_count >= BBR_FULL_BW_ROUNDS) {
+            b->filled_pipe = 1;
+        }
+    }
+    if (b->mode == BBR_STARTUP && b->filled_pipe) {
+        b->mode = BBR_DRAIN;
+    }
+    if (b->mode == BBR_DRAIN &&
+        swnd_pipe(&(sock->send_window)) <= bbr_target_cwnd(sock, BBR_UNIT)) {
+        bbr_enter_probe_bw(b, now);
+    }
+}
+
+/**
+ * Keeps the minimum RTT, and enters PROBE_RTT to measure it again once it
+ * gets old: the window drops to BBR_MIN_CWND for BBR_PROBE_RTT_TIME and a
+ * round trip.
+ */
+static void bbr_update_min_rtt(foggy_socket_t* sock,
+    const swnd_rate_sample_t* rs, int64_t now) {
+    bbr_t* b = bbr(sock);
+    window_t* win = &(sock->window);
+    send_window_ring_t* swnd = &(sock->send_window);
+    int expired = now - b->min_rtt_stamp > BBR_MIN_RTT_WINDOW;
+
+    if (rs->rtt >= 0 && (rs->rtt < b->min_rtt || expired)) {
+        b->min_rtt = rs->rtt;
+        b->min_rtt_stamp = now;
+    }
+    if (expired && b->mode != BBR_PROBE_RTT) {
+        b->mode = BBR_PROBE_RTT;
+        b->prior_cwnd = b->in_recovery ?
+            MAX(b->prior_cwnd, win->congestion_window) : win->congestion_window;
+        b->probe_rtt_done = 0;
+    }
+    if (b->mode != BBR_PROBE_RTT) {
+        return;
+    }
+
+    // The samples of PROBE_RTT are not of the path.
+    swnd_app_limited(swnd);
+    if (b->probe_rtt_done == 0 && swnd_pipe(swnd) <= BBR_MIN_CWND) {
+        b->probe_rtt_done = now + BBR_PROBE_RTT_TIME;
+        b->probe_rtt_round_done = 0;
+        b->next_round_delivered = swnd->delivered;
+    }
+    else if (b->probe_rtt_done != 0) {
+        if (b->round_start) {
+            b->probe_rtt_round_done = 1;
+        }
+        if (b->probe_rtt_round_done && now > b->probe_rtt_done) {
+            b->min_rtt_stamp = now;
+            win->congestion_window =
+                MAX(win->congestion_window, b->prior_cwnd);
+            if (b->filled_pipe) {
+                bbr_enter_probe_bw(b, now);
+            }
+            else {
+                b->mode = BBR_STARTUP;
+            }
+        }
+    }
+}
+
+static void bbr_update_gains(bbr_t* b) {
+    switch (b->mode) {
+    case BBR_STARTUP:
+        b->pacing_gain = BBR_HIGH_GAIN;
+        b->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_DRAIN:
+        b->pacing_gain = BBR_DRAIN_GAIN;
+        b->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_PROBE_BW:
+        b->pacing_gain = bbr_pacing_gain[b->cycle_index];
+        b->cwnd_gain = BBR_CWND_GAIN;
+        break;
+    case BBR_PROBE_RTT:
+        b->pacing_gain = BBR_UNIT;
+        b->cwnd_gain = BBR_UNIT;
+        break;
+    }
+}
+
+/**
+ * Grows the window by what was delivered, up to cwnd_gain times the BDP;
+ * before the pipe is full, it only grows.
+ */
+static void bbr_set_cwnd(foggy_socket_t* sock, const swnd_rate_sample_t* rs) {
+    bbr_t* b = bbr(sock);
+    window_t* win = &(sock->window);
+    send_window_ring_t* swnd = &(sock->send_window);
+    uint32_t acked = rs->newly_delivered;
+    uint32_t cwnd = win->congestion_window;
+
+    if (b->in_recovery && !before(win->send_base, b->recovery_end)) {
+        b->in_recovery = 0;
+        b->conservation = 0;
+        cwnd = MAX(cwnd, b->prior_cwnd);
+    }
+    if (b->in_recovery && b->conservation) {
+        cwnd = MAX(cwnd, swnd_pipe(swnd) + acked);
+    }
+    else {
+        uint32_t target = bbr_target_cwnd(sock, b->cwnd_gain);
+
+        if (b->filled_pipe) {
+            cwnd = MIN(cwnd + acked, target);
+        }
+        else if (cwnd < target || swnd->delivered < BBR_INIT_CWND) {
+            cwnd += acked;
+        }
+        cwnd = MAX(cwnd, BBR_MIN_CWND);
+    }
+    if (b->mode == BBR_PROBE_RTT) {
+        cwnd = MIN(cwnd, BBR_MIN_CWND);
+    }
+    win->congestion_window = cwnd;
+}
+
+static void bbr_init(foggy_socket_t* sock) {
+    bbr_t* b = bbr(sock);
+    int64_t now = get_time_in_ns();
+
+    b->min_rtt = RTT_INFINITE;
+    b->min_rtt_stamp = now;
+    b->next_round_delivered = sock->send_window.delivered;
+    b->mode = BBR_STARTUP;
+    bbr_update_gains(b);
+    bbr_init_pacing_rate(sock);
+}
+
+static void bbr_cong_control(foggy_socket_t* sock,
+    const swnd_rate_sample_t* rs) {
+    bbr_t* b = bbr(sock);
+    int64_t now = get_time_in_ns();
+
+    bbr_update_bw(sock, rs);
+    bbr_update_cycle_phase(sock, rs, now);
+    bbr_check_full_pipe(sock, rs, now);
+    bbr_update_min_rtt(sock, rs, now);
+    bbr_update_gains(b);
+    bbr_set_pacing_rate(sock);
+    bbr_set_cwnd(sock, rs);
+}
+
+/**
+ * Starts a recovery: the window is kept at what is in flight for a round
+ * (packet conservation), and restored when the recovery ends.
+ */
+static void bbr_start_recovery(foggy_socket_t* sock, uint32_t cwnd) {
+    bbr_t* b = bbr(sock);
+    window_t* win = &(sock->window);
+
+    b->prior_cwnd = b->in_recovery || b->mode == BBR_PROBE_RTT ?
+        MAX(b->prior_cwnd, win->congestion_window) : win->congestion_window;
+    b->in_recovery = 1;
+    b->conservation = 1;
+    b->recovery_end = win->next_seq_num;
+    b->next_round_delivered = sock->send_window.delivered;
+    win->congestion_window = cwnd;
+}
+
+static void bbr_on_loss(foggy_socket_t* sock) {
+    bbr_start_recovery(sock, MAX(swnd_pipe(&(sock->send_window)), MSS));
+}
+
+/**
+ * Everything in flight is deemed lost: restart from one segment. As in
+ * Linux, the timeout ends the round, and the bandwidth reached is forgotten;
+ * while STARTUP has not filled the pipe yet, it looks for the plateau from
+ * scratch. A filled pipe stays filled: the model still holds.
+ */
+static void bbr_on_rto(foggy_socket_t* sock) {
+    bbr_t* b = bbr(sock);
+
+    bbr_start_recovery(sock, MSS);
+    b->round_start = 1;
+    b->full_bw = 0;
+    b->full_bw_count = 0;
+}
+
+static uint32_t bbr_cwnd(foggy_socket_t* sock) {
+    return sock->window.congestion_window;
+}
+
+static uint64_t bbr_pacing_rate(foggy_socket_t* sock) {
+    return bbr(sock)->pacing_rate;
+}
+
+const cc_ops_t cc_bbr = {
+    "bbr",
+    bbr_init,
+    NULL,
+    bbr_on_loss,
+    bbr_on_rto,
+    NULL,
+    bbr_cwnd,
+    bbr_pacing_rate,
+    bbr_cong_control,
+};
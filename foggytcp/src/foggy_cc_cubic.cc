@@ -0,0 +1,296 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements CUBIC (RFC 9438), with HyStart++ (RFC 9406) to end
+ * the initial slow start.
+ *
+ * In congestion avoidance, the window follows a cubic function of the time
+ * since the last reduction, centered on the window before it (W_max): it
+ * grows back quickly, flattens around W_max, then probes beyond it. On short
+ * RTTs, where the cubic would grow slower than Reno, the window follows an
+ * estimate of what Reno would have reached instead. After a loss, the window
+ * is reduced to beta = 0.7 of itself, and the recovery is NewReno's.
+ *
+ * HyStart++ watches the minimum RTT of each round trip during the initial
+ * slow start: when it rises, the queue of the bottleneck is building up, and
+ * the window grows four times slower for a few rounds (conservative slow
+ * start) before congestion avoidance takes over, instead of overshooting
+ * into a burst of losses.
+ */
+
+#include <math.h>
+
+#include "foggy_cc.h"
+#include "foggy_function.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+// Growth of the Reno-friendly window per RTT, in segments.
+#define CUBIC_ALPHA (3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA))
+
+// HyStart++ parameters, as recommended by RFC 9406. RTTs are in ns.
+#define HYSTART_MIN_RTT_THRESH 4000000
+#define HYSTART_MAX_RTT_THRESH 16000000
+#define HYSTART_MIN_RTT_DIVISOR 8
+#define HYSTART_N_RTT_SAMPLE 8
+#define HYSTART_CSS_GROWTH_DIVISOR 4
+#define HYSTART_CSS_ROUNDS 5
+// Most growth per ACK in slow start: segments are not paced.
+#define HYSTART_ACK_LIMIT (8 * MSS)
+
+#define RTT_INFINITE INT64_MAX
+
+typedef enum {
+    HYSTART_SLOW_START = 0,
+    HYSTART_CSS = 1,   // Conservative slow start.
+    HYSTART_DONE = 2,  // Only the initial slow start uses HyStart++.
+} hystart_state_t;
+
+typedef struct {
+    // Windows are in segments, times in seconds unless noted.
+    double w_max;        // Window before the last reduction, fast convergence applied.
+    double cwnd_prior;   // Window before the last reduction.
+    double w_est;        // Window Reno would have in this epoch.
+    double k;            // When the cubic reaches w_max again.
+    double growth;       // Bytes owed to the window, below one.
+    int64_t epoch_start; // Start of the congestion avoidance epoch in ns, 0 before it.
+
+    hystart_state_t hystart;
+    uint32_t round_end;         // The round trip ends when this is acknowledged.
+    uint32_t rtt_samples;       // Samples in the current round.
+    int css_rounds;             // Rounds in conservative slow start.
+    int64_t round_min_rtt;      // ns.
+    int64_t last_round_min_rtt; // ns.
+    int64_t css_baseline_rtt;   // Minimum RTT of the round that entered CSS, ns.
+} cubic_t;
+
+static_assert(sizeof(cubic_t) <= CC_PRIV_WORDS * sizeof(uint64_t),
+              "cubic_t does not fit in cc_priv");
+
+static cubic_t* cubic(foggy_socket_t* sock) {
+    return (cubic_t*)sock->cc_priv;
+}
+
+/**
+ * Returns the window the cubic function gives `t` seconds into the epoch,
+ * in segments.
+ */
+static double w_cubic(cubic_t* c, double t) {
+    return CUBIC_C * (t - c->k) * (t - c->k) * (t - c->k) + c->w_max;
+}
+
+static void cubic_init(foggy_socket_t* sock) {
+    cubic_t* c = cubic(sock);
+    window_t* win = &(sock->window);
+
+    c->round_end = win->next_seq_num;
+    c->round_min_rtt = RTT_INFINITE;
+    c->last_round_min_rtt = RTT_INFINITE;
+    c->css_baseline_rtt = RTT_INFINITE;
+    if (win->reno_state == RENO_SLOW_START &&
+        win->ssthresh == WINDOW_INITIAL_SSTHRESH) {
+        // Still in the initial slow start: HyStart++ ends it, not ssthresh.
+        win->ssthresh = UINT32_MAX;
+        c->hystart = HYSTART_SLOW_START;
+    }
+    else {
+        c->hystart = HYSTART_DONE;
+    }
+}
+
+/**
+ * Ends conservative slow start, and slow start with it.
+ */
+static void hystart_exit(foggy_socket_t* sock) {
+    window_t* win = &(sock->window);
+
+    cubic(sock)->hystart = HYSTART_DONE;
+    win->ssthresh = win->congestion_window;
+    win->reno_state = RENO_CONGESTION_AVOIDANCE;
+}
+
+/**
+ * Follows the round trips and their minimum RTT during the initial slow
+ * start, and moves between slow start and conservative slow start.
+ *
+ * @param sock The socket.
+ * @param rtt The RTT sample of the ACK in ns, or -1.
+ */
+static void hystart_on_ack(foggy_socket_t* sock, int64_t rtt) {
+    cubic_t* c = cubic(sock);
+    window_t* win = &(sock->window);
+
+    if (!before(win->send_base, c->round_end)) {
+        c->round_end = win->next_seq_num;
+        c->last_round_min_rtt = c->round_min_rtt;
+        c->round_min_rtt = RTT_INFINITE;
+        c->rtt_samples = 0;
+        if (c->hystart == HYSTART_CSS &&
+            ++c->css_rounds >= HYSTART_CSS_ROUNDS) {
+            hystart_exit(sock);
+            return;
+        }
+    }
+    if (rtt >= 0) {
+        c->round_min_rtt = MIN(c->round_min_rtt, rtt);
+        ++c->rtt_samples;
+    }
+    if (c->rtt_samples < HYSTART_N_RTT_SAMPLE) {
+        return;
+    }
+
+    if (c->hystart == HYSTART_SLOW_START) {
+        if (c->last_round_min_rtt == RTT_INFINITE) {
+            return;
+        }
+        int64_t thresh = c->last_round_min_rtt / HYSTART_MIN_RTT_DIVISOR;
+        thresh = MAX(HYSTART_MIN_RTT_THRESH,
+                     MIN(thresh, HYSTART_MAX_RTT_THRESH));
+        if (c->round_min_rtt >= c->last_round_min_rtt + thresh) {
+            c->css_baseline_rtt = c->round_min_rtt;
+            c->css_rounds = 0;
+            c->hystart = HYSTART_CSS;
+        }
+    }
+    else if (c->round_min_rtt < c->css_baseline_rtt) {
+        // The RTT came back down: the increase was spurious.
+        c->css_baseline_rtt = RTT_INFINITE;
+        c->hystart = HYSTART_SLOW_START;
+    }
+}
+
+/**
+ * Grows the window in congestion avoidance (RFC 9438 section 4.2 to 4.4).
+ */
+static void cubic_update(foggy_socket_t* sock, uint32_t acked) {
+    cubic_t* c = cubic(sock);
+    window_t* win = &(sock->window);
+    int64_t now = get_time_in_ns();
+    double cwnd = (double)win->congestion_window / MSS;
+
+    if (c->epoch_start == 0) {
+        c->epoch_start = now;
+        c->w_est = cwnd;
+        c->growth = 0;
+        if (c->w_max > cwnd) {
+            c->k = cbrt((c->w_max - cwnd) / CUBIC_C);
+        }
+        else {
+            // No reduction to recover from, or the one of a timeout: probe
+            // from the window at hand.
+            c->w_max = cwnd;
+            c->k = 0;
+        }
+    }
+
+    double t = (now - c->epoch_start) / 1e9;
+    double target = w_cubic(c, t + win->srtt / 1e9);
+    target = MAX(cwnd, MIN(target, 1.5 * cwnd));
+
+    double alpha = c->w_est >= c->cwnd_prior ? 1 : CUBIC_ALPHA;
+    c->w_est += alpha * acked / MSS / cwnd;
+
+    if (w_cubic(c, t) < c->w_est) {
+        // Reno-friendly region.
+        win->congestion_window =
+            MAX(win->congestion_window, (uint32_t)(c->w_est * MSS));
+        return;
+    }
+    c->growth += (target - cwnd) / cwnd * acked;
+    uint32_t inc = (uint32_t)c->growth;
+    c->growth -= inc;
+    win->congestion_window += inc;
+}
+
+static void cubic_on_ack(foggy_socket_t* sock, uint32_t acked, int64_t rtt) {
+    cubic_t* c = cubic(sock);
+    window_t* win = &(sock->window);
+
+    if (cc_recovery_on_ack(sock, acked) || acked == 0) {
+        return;
+    }
+
+    if (c->hystart != HYSTART_DONE) {
+        hystart_on_ack(sock, rtt);
+    }
+    if (win->congestion_window < win->ssthresh) {
+        if (c->hystart == HYSTART_DONE) {
+            win->congestion_window += MIN(acked, MSS);
+        }
+        else {
+            uint32_t inc = MIN(acked, HYSTART_ACK_LIMIT);
+            if (c->hystart == HYSTART_CSS) {
+                inc /= HYSTART_CSS_GROWTH_DIVISOR;
+            }
+            win->congestion_window += inc;
+        }
+        if (win->congestion_window >= win->ssthresh) {
+            win->reno_state = RENO_CONGESTION_AVOIDANCE;
+        }
+        return;
+    }
+    cubic_update(sock, acked);
+    win->reno_state = RENO_CONGESTION_AVOIDANCE;
+}
+
+/**
+ * Remembers the window before a reduction, and ends the epoch. With fast
+ * convergence, a window that did not reach the previous W_max releases
+ * bandwidth to the flows that joined since.
+ */
+static void cubic_reduce(foggy_socket_t* sock) {
+    cubic_t* c = cubic(sock);
+    window_t* win = &(sock->window);
+    double cwnd = (double)win->congestion_window / MSS;
+
+    c->cwnd_prior = cwnd;
+    c->w_max = cwnd < c->w_max ? cwnd * (1 + CUBIC_BETA) / 2 : cwnd;
+    c->epoch_start = 0;
+    c->hystart = HYSTART_DONE;
+    win->ssthresh =
+        MAX((uint32_t)(win->congestion_window * CUBIC_BETA), 2 * MSS);
+}
+
+static void cubic_on_loss(foggy_socket_t* sock) {
+    window_t* win = &(sock->window);
+
+    cubic_reduce(sock);
+    win->congestion_window = win->ssthresh +
+        (win->sack_seen ? 0 : DUP_ACK_THRESHOLD * MSS);
+}
+
+/**
+ * Falls back to slow start from one segment. The next epoch starts from the
+ * window slow start reaches (RFC 9438 section 4.8).
+ */
+static void cubic_on_rto(foggy_socket_t* sock) {
+    cubic_reduce(sock);
+    cubic(sock)->w_max = 0;
+    sock->window.congestion_window = MSS;
+}
+
+static uint32_t cubic_cwnd(foggy_socket_t* sock) {
+    return sock->window.congestion_window;
+}
+
+const cc_ops_t cc_cubic = {
+    "cubic",
+    cubic_init,
+    cubic_on_ack,
+    cubic_on_loss,
+    cubic_on_rto,
+    NULL,
+    cubic_cwnd,
+    NULL,
+    NULL,
+};
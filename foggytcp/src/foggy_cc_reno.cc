@@ -0,0 +1,112 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements NewReno (RFC 5681, RFC 6582): slow start, congestion
+ * avoidance, and the window of a fast recovery. Without SACK, the window is
+ * inflated by the duplicate ACKs and deflated by the partial ACKs; with
+ * SACK, the protocol counts what is in flight, and the window stays put.
+ */
+
+#include "foggy_cc.h"
+#include "foggy_function.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+/**
+ * Halves the window on a loss, with room for the segments that triggered
+ * the duplicate ACKs if the peer does not SACK.
+ */
+static void reno_on_loss(foggy_socket_t* sock) {
+    window_t* win = &(sock->window);
+
+    win->ssthresh = MAX(swnd_out(&(sock->send_window)) / 2, 2 * MSS);
+    win->congestion_window = win->ssthresh +
+        (win->sack_seen ? 0 : DUP_ACK_THRESHOLD * MSS);
+}
+
+int cc_recovery_on_ack(foggy_socket_t* sock, uint32_t acked) {
+    window_t* win = &(sock->window);
+
+    if (win->reno_state != RENO_FAST_RECOVERY) {
+        return 0;
+    }
+    if (acked == 0) {
+        // A segment left the network: inflate the window, unless the
+        // protocol counts what is in flight.
+        if (!win->sack_seen) {
+            win->congestion_window += MSS;
+        }
+        return 1;
+    }
+    if (!before(win->send_base, win->recovery_point)) {
+        // Full ACK: deflate the window.
+        win->congestion_window = win->ssthresh;
+        return 1;
+    }
+    if (!win->sack_seen) {
+        win->congestion_window -= MIN(acked, win->congestion_window);
+        if (acked >= MSS) {
+            win->congestion_window += MSS;
+        }
+        win->congestion_window = MAX(win->congestion_window, MSS);
+    }
+    return 1;
+}
+
+/**
+ * Grows the window outside a fast recovery, and shapes it within one.
+ */
+static void reno_on_ack(foggy_socket_t* sock, uint32_t acked, int64_t rtt) {
+    window_t* win = &(sock->window);
+
+    (void)rtt;
+    if (cc_recovery_on_ack(sock, acked) || acked == 0) {
+        return;
+    }
+
+    if (win->congestion_window < win->ssthresh) {
+        win->congestion_window += MIN(acked, MSS);
+        if (win->congestion_window >= win->ssthresh) {
+            win->reno_state = RENO_CONGESTION_AVOIDANCE;
+        }
+    }
+    else {
+        win->congestion_window +=
+            MAX(MSS * MSS / win->congestion_window, 1);
+        win->reno_state = RENO_CONGESTION_AVOIDANCE;
+    }
+}
+
+/**
+ * Falls back to slow start from one segment.
+ */
+static void reno_on_rto(foggy_socket_t* sock) {
+    window_t* win = &(sock->window);
+
+    win->ssthresh = MAX(swnd_out(&(sock->send_window)) / 2, 2 * MSS);
+    win->congestion_window = MSS;
+}
+
+static uint32_t reno_cwnd(foggy_socket_t* sock) {
+    return sock->window.congestion_window;
+}
+
+const cc_ops_t cc_reno = {
+    "reno",
+    NULL,
+    reno_on_ack,
+    reno_on_loss,
+    reno_on_rto,
+    NULL,
+    reno_cwnd,
+    NULL,
+    NULL,
+};
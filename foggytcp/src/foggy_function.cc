@@ -1,18 +1,20 @@
 /* Copyright (C) 2024 Hong Kong University of Science and Technology */
 
-#include <deque>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 
 #include "foggy_function.h"
 #include "foggy_backend.h"
+#include "foggy_option.h"
 
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
-#define DEBUG_PRINT 1
+// Traces of every segment, on stdout; off by default, they cost a write()
+// per line on a terminal.
+#define DEBUG_PRINT 0
 #define debug_printf(fmt, ...) \
   do { \
     if (DEBUG_PRINT) fprintf(stdout, fmt, ##__VA_ARGS__); \
@@ -22,23 +24,116 @@
 // -------------------- FONCTIONS D'ASSISTANCE --------------------------
 // ----------------------------------------------------------------------
 
+/**
+ * Returns the clock of the timestamp option: CLOCK_MONOTONIC in s, fine
+ * enough for RTTs of a LAN. It wraps every 71 minutes.
+ */
+static uint32_t ts_now() {
+    return (uint32_t)(get_time_in_ns() / 1000);
+}
+
+/**
+ * Writes the timestamp option, if it is in use on the socket.
+ * @param sock The socket.
+ * @param ext Where to write it, with room for OPT_TIMESTAMP_SIZE bytes.
+ * @return The number of bytes written.
+ */
+static uint16_t put_timestamp(foggy_socket_t* sock, uint8_t* ext) {
+    if (!sock->ts_enabled) {
+        return 0;
+    }
+    return opt_put_timestamp(ext, ts_now(), sock->ts_recent);
+}
+
+/**
+ * Queues a segment of the send window for transmission: its header, built in
+ * the header storage of the slot, then its payload straight from the send
+ * ring (in two pieces if it wraps around the end of the ring).
+ * @param sock Le socket.
+ * @param slot The segment to send.
+ */
+static void transmit_segment(foggy_socket_t* sock, send_window_slot_t* slot) {
+    uint8_t* hdr = swnd_hdr(&(sock->send_window), slot);
+    uint32_t offset = slot->seq - sock->send_ring_seq;
+    struct iovec iov[BACKEND_PKT_IOVS];
+    uint16_t ext_len, hlen;
+    uint8_t* data;
+    uint32_t first;
+    int iovcnt = 2;
+
+    // The options go straight after the fixed header, which set_header()
+    // leaves alone.
+    ext_len = put_timestamp(sock,
+        get_extension_data((foggy_tcp_header_t*)hdr));
+    hlen = sizeof(foggy_tcp_header_t) + ext_len;
+    set_header((foggy_tcp_header_t*)hdr,
+        sock->my_port, ntohs(sock->conn.sin_port),
+        slot->seq, sock->window.next_seq_expected, // Seq/Ack
+        hlen, hlen + slot->len,
+        ACK_FLAG_MASK,
+        get_receive_window(sock), 0, NULL);
+    set_extension_length((foggy_tcp_header_t*)hdr, ext_len);
+    swnd_sent(&(sock->send_window), slot, get_time_in_ns());
+    cc_on_send(sock, slot->len);
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = hlen;
+    first = MIN(ring_peek(&(sock->send_ring), offset, &data), slot->len);
+    iov[1].iov_base = data;
+    iov[1].iov_len = first;
+    if (first < slot->len) {
+        ring_peek(&(sock->send_ring), offset + first, &data);
+        iov[2].iov_base = data;
+        iov[2].iov_len = slot->len - first;
+        iovcnt = 3;
+    }
+    queue_pkt_iov(sock, iov, iovcnt, NULL);
+}
+
 // Fonction de retransmission appele par le timer ( insrer dans foggy_function.cc)
 void on_retransmit_timer(foggy_socket_t* sock) {
-    if (sock->send_window.empty()) return;
+    send_window_ring_t* swnd = &(sock->send_window);
+    send_window_slot_t* front;
+
+    // The SYN or SYN-ACK got no answer: send it again, with the same backoff
+    // as data.
+    if (sock->state == TCP_SYN_SENT || sock->state == TCP_SYN_RCVD) {
+        sock->window.rto = MIN(sock->window.rto * 2, RTO_MAX);
+        send_syn(sock);
+        return;
+    }
+
+    if (swnd_empty(swnd)) return;
 
-    // Retransmission Timeout (RTO): on retransmet le paquet SendBase et toute la fentre (Go-Back-N)
+    // Retransmission Timeout (RTO): on retransmet le paquet SendBase et les trous de la fentre
 
-    // 1. Re-dmarrer le timer immdiatement
+    // 1. Re-dmarrer le timer immdiatement, avec un RTO doubl (RFC 6298,
+    // 5.5) ; il le reste jusqu' la prochaine mesure du RTT.
+    sock->window.rto = MIN(sock->window.rto * 2, RTO_MAX);
     start_retransmit_timer(sock);
 
-    // 2. Prparation  la retransmission : marquer tous les paquets dans la fentre comme non envoys
-    debug_printf("Timeout! Retransmitting all packets from SendBase %d\n", sock->window.send_base);
+    // A timeout is a congestion signal (RFC 5681), unless it only probes a
+    // closed window.
+    if (sock->window.advertised_window > 0) {
+        cc_on_rto(sock);
+        sock->window.reno_state = RENO_SLOW_START;
+        sock->window.recovery_point = sock->window.next_seq_num;
+    }
+    sock->window.dup_ack_count = 0;
+
+    // 2. Every segment sent and not SACKed is deemed lost: only the holes
+    // the peer reported are sent again.
+    debug_printf("Timeout! Retransmitting the holes from SendBase %d\n", sock->window.send_base);
+    swnd_mark_all_lost(swnd);
 
-    // Parcourir la file d'envoi et marquer tout ce qui est aprs SendBase comme " renvoyer"
-    std::deque<send_window_slot_t>::iterator it = sock->send_window.begin();
-    for (; it != sock->send_window.end(); ++it) {
-        // Dans une implmentation GBN simple, on retransmet tout ce qui n'est pas acquitt.
-        it->is_sent = 0;
+    // The first segment goes out even if the peer's window is closed, to
+    // probe it: the ACK tells us when the window reopens.
+    front = swnd_front(swnd);
+    if (!(front->flags & SWND_SACKED)) {
+        if (swnd->next_send == swnd->head) {
+            swnd->next_send++;
+        }
+        transmit_segment(sock, front);
     }
 
     // 3. Envoyer la fentre
@@ -50,6 +145,314 @@ void on_retransmit_timer(foggy_socket_t* sock) {
 // -------------------- LOGIQUE TCP - FENTRE GLISSANTE -----------------
 // ----------------------------------------------------------------------
 
+/**
+ * Records the SACK blocks of an ACK in the scoreboard, then flags as lost the
+ * segments they leave behind (RFC 6675).
+ * @param sock The socket.
+ * @param hdr The header of the ACK.
+ * @return The number of segments newly SACKed.
+ */
+static uint32_t update_scoreboard(foggy_socket_t* sock, foggy_tcp_header_t* hdr) {
+    sack_block_t blocks[OPT_SACK_MAX_BLOCKS];
+    uint32_t newly = 0;
+    int count;
+
+    count = opt_get_sack(get_extension_data(hdr), get_extension_length(hdr),
+        blocks);
+    if (count > 0) {
+        sock->window.sack_seen = 1;
+    }
+    for (int i = 0; i < count; ++i) {
+        // Ignore blocks that are stale or cover data never sent.
+        if (!after(blocks[i].end, sock->window.send_base) ||
+            after(blocks[i].end, sock->window.next_seq_num) ||
+            !before(blocks[i].start, blocks[i].end)) {
+            continue;
+        }
+        newly += swnd_sack(&(sock->send_window), blocks[i].start,
+            blocks[i].end, MSS);
+    }
+    if (newly > 0) {
+        swnd_mark_lost(&(sock->send_window), DUP_ACK_THRESHOLD);
+    }
+    return newly;
+}
+
+/**
+ * Feeds an RTT sample to the Jacobson/Karels estimator and derives the RTO
+ * from it (RFC 6298). When several samples are taken per RTT, their gains
+ * are divided among them (RFC 7323, appendix G): otherwise the variation
+ * fades within one RTT and the RTO gets too short.
+ * @param sock The socket.
+ * @param rtt The sample in ns.
+ * @param per_rtt The number of samples expected per RTT.
+ */
+static void update_rtt(foggy_socket_t* sock, int64_t rtt, int64_t per_rtt) {
+    window_t* win = &(sock->window);
+    int64_t rto;
+
+    if (win->srtt == 0) {
+        win->srtt = rtt;
+        win->rttvar = rtt / 2;
+    }
+    else {
+        int64_t err = win->srtt - rtt;
+        win->rttvar += ((err < 0 ? -err : err) - win->rttvar) / (4 * per_rtt);
+        win->srtt += (rtt - win->srtt) / (8 * per_rtt);
+    }
+    rto = win->srtt + MAX(RTO_GRANULARITY, 4 * win->rttvar);
+    // Round up to the ms of the timer; a new sample also ends any backoff.
+    rto = (rto + 999999) / 1000000;
+    win->rto = (int32_t)MIN(MAX(rto, RTO_MIN), RTO_MAX);
+}
+
+/**
+ * Takes an RTT sample from an ACK that acknowledges new data: the time since
+ * the last segment it covers was sent. Following Karn's algorithm, there is
+ * no sample when that segment or the oldest one it covers was retransmitted,
+ * since the ACK may answer any of the transmissions. Segments SACKed earlier
+ * give none either, as they reached the peer before this ACK was sent.
+ * @param sock The socket.
+ * @param ack The acknowledgement number.
+ * @return The sample in ns, or -1 if there is none.
+ */
+static int64_t sample_rtt(foggy_socket_t* sock, uint32_t ack) {
+    send_window_ring_t* swnd = &(sock->send_window);
+    send_window_slot_t* last;
+    int64_t rtt;
+    uint32_t i;
+
+    if (swnd_empty(swnd) || swnd_front(swnd)->retransmits > 0) {
+        return -1;
+    }
+    i = swnd_find(swnd, ack - 1, MSS);
+    if (i == swnd_count(swnd)) {
+        return -1;
+    }
+    last = swnd_at(swnd, i);
+    if (last->retransmits > 0 || (last->flags & SWND_SACKED) ||
+        !(last->flags & SWND_SENT)) {
+        return -1;
+    }
+    rtt = get_time_in_ns() - last->send_time;
+    update_rtt(sock, rtt, 1);
+    return rtt;
+}
+
+/**
+ * Takes an RTT sample from the TSecr of an ACK (RFC 7323): the segment it
+ * echoes may be a retransmission, there is no ambiguity.
+ * @param sock The socket.
+ * @param tsecr The TSval of ours that the peer echoed.
+ * @return The sample in ns, or -1 if there is none.
+ */
+static int64_t sample_rtt_ts(foggy_socket_t* sock, uint32_t tsecr) {
+    int32_t rtt = (int32_t)(ts_now() - tsecr);
+    // The peer acknowledges every other segment at least.
+    uint32_t per_rtt = swnd_out(&(sock->send_window)) / (2 * MSS);
+
+    // A TSecr from the future is bogus.
+    if (rtt < 0) {
+        return -1;
+    }
+    update_rtt(sock, (int64_t)rtt * 1000, MAX(per_rtt, 1));
+    return (int64_t)rtt * 1000;
+}
+
+/**
+ * Records the peer's TSval to echo (RFC 7323, 4.3): that of the segments at
+ * or before the left edge of the window, so that the echo of a hole being
+ * filled measures the retransmission, and an out-of-order segment does not
+ * shorten the RTT of the ACK it triggers.
+ * @param sock The socket.
+ * @param seq The sequence number of the segment.
+ * @param tsval Its TSval.
+ */
+static void update_ts_recent(foggy_socket_t* sock, uint32_t seq, uint32_t tsval) {
+    if (before_or_equal(seq, sock->window.next_seq_expected)) {
+        sock->ts_recent = tsval;
+        sock->ts_recent_time = get_time_in_ns();
+    }
+}
+
+/**
+ * PAWS (RFC 7323, 5): tells if a segment is an old duplicate, with a TSval
+ * older than the latest one recorded. After a long silence the peer's clock
+ * may have wrapped, so an old ts_recent is no longer trusted.
+ * @param sock The socket.
+ * @param tsval The TSval of the segment.
+ */
+static int paws_reject(foggy_socket_t* sock, uint32_t tsval) {
+    return (int32_t)(tsval - sock->ts_recent) < 0 &&
+        get_time_in_ns() - sock->ts_recent_time < TS_RECENT_MAX_AGE;
+}
+
+/**
+ * Completes the handshake: the SYN was acknowledged, data may flow.
+ * @param sock The socket.
+ */
+static void establish(foggy_socket_t* sock) {
+    sock->state = TCP_ESTABLISHED;
+    // The SYN takes one sequence number.
+    sock->window.send_base++;
+    stop_retransmit_timer(sock);
+}
+
+/**
+ * Keeps the options of the socket that the peer's SYN or SYN-ACK offers too,
+ * and turns off the others.
+ * @param sock The socket.
+ * @param hdr The header of the SYN.
+ * @param tsval Set to the TSval of the SYN, if timestamps are in use.
+ * @param tsecr Set to its TSecr.
+ */
+static void negotiate_options(foggy_socket_t* sock, foggy_tcp_header_t* hdr,
+    uint32_t* tsval, uint32_t* tsecr) {
+    uint8_t* ext = get_extension_data(hdr);
+    uint16_t ext_len = get_extension_length(hdr);
+    uint8_t shift;
+
+    sock->ts_enabled = sock->ts_enabled &&
+        opt_get_timestamp(ext, ext_len, tsval, tsecr);
+
+    sock->ws_enabled = sock->ws_enabled && opt_get_wscale(ext, ext_len, &shift);
+    if (sock->ws_enabled) {
+        sock->snd_wscale = shift;
+    }
+    else {
+        __atomic_store_n(&(sock->rcv_wscale), 0, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Handles a SYN or a SYN-ACK. The options of the socket stay in use only if
+ * the peer's SYN carries them too. The windows of both are not scaled.
+ * @param sock The socket.
+ * @param hdr The header of the segment.
+ */
+static void on_syn(foggy_socket_t* sock, foggy_tcp_header_t* hdr) {
+    uint8_t flags = get_flags(hdr);
+    uint32_t tsval, tsecr;
+
+    switch (sock->state) {
+    case TCP_LISTEN:
+        if (flags & ACK_FLAG_MASK) {
+            return;
+        }
+        sock->window.next_seq_expected = get_seq(hdr) + 1;
+        sock->window.advertised_window = get_advertised_window(hdr);
+        negotiate_options(sock, hdr, &tsval, &tsecr);
+        if (sock->ts_enabled) {
+            update_ts_recent(sock, get_seq(hdr), tsval);
+        }
+        sock->state = TCP_SYN_RCVD;
+        send_syn(sock);
+        return;
+
+    case TCP_SYN_RCVD:
+        // Our SYN-ACK was lost and the peer sends its SYN again.
+        if (!(flags & ACK_FLAG_MASK) &&
+            get_seq(hdr) + 1 == sock->window.next_seq_expected) {
+            send_syn(sock);
+        }
+        return;
+
+    case TCP_SYN_SENT:
+        if (!(flags & ACK_FLAG_MASK) ||
+            get_ack(hdr) != sock->window.send_base + 1) {
+            return;
+        }
+        sock->window.next_seq_expected = get_seq(hdr) + 1;
+        sock->window.advertised_window = get_advertised_window(hdr);
+        negotiate_options(sock, hdr, &tsval, &tsecr);
+        if (sock->ts_enabled) {
+            update_ts_recent(sock, get_seq(hdr), tsval);
+            sample_rtt_ts(sock, tsecr);
+        }
+        establish(sock);
+        send_ack(sock);
+        return;
+
+    case TCP_ESTABLISHED:
+        // Our ACK of the SYN-ACK was lost: the peer sends it again.
+        if (flags & ACK_FLAG_MASK) {
+            send_ack(sock);
+        }
+        return;
+    }
+}
+
+/**
+ * Enters fast recovery (RFC 6582): the congestion control reduces the window
+ * and the oldest unacknowledged segment is retransmitted.
+ * @param sock The socket.
+ */
+static void enter_fast_recovery(foggy_socket_t* sock) {
+    window_t* win = &(sock->window);
+    send_window_ring_t* swnd = &(sock->send_window);
+
+    debug_printf("Fast retransmit of packet %d\n", win->send_base);
+    win->recovery_point = win->next_seq_num;
+    win->reno_state = RENO_FAST_RECOVERY;
+    cc_on_loss(sock);
+    swnd_lose(swnd, swnd_front(swnd));
+}
+
+/**
+ * Handles an ACK that acknowledges new data: partial and full ACKs of a fast
+ * recovery (RFC 6582), and the congestion control.
+ * @param sock The socket.
+ * @param acked The number of bytes newly acknowledged.
+ * @param rtt The RTT sample of the ACK in ns, or -1.
+ */
+static void on_new_ack(foggy_socket_t* sock, uint32_t acked, int64_t rtt) {
+    window_t* win = &(sock->window);
+    send_window_ring_t* swnd = &(sock->send_window);
+    int full = !before(win->send_base, win->recovery_point);
+
+    win->dup_ack_count = 0;
+    // Partial ACK: the next hole is lost as well, retransmit it.
+    if (win->reno_state == RENO_FAST_RECOVERY && !full &&
+        !swnd_empty(swnd)) {
+        swnd_lose(swnd, swnd_front(swnd));
+    }
+    cc_on_ack(sock, acked, rtt);
+    // Full ACK: leave recovery.
+    if (win->reno_state == RENO_FAST_RECOVERY && full) {
+        win->reno_state = RENO_CONGESTION_AVOIDANCE;
+    }
+}
+
+/**
+ * Handles a duplicate ACK: counts it, enters fast recovery on the third one,
+ * or once the scoreboard deems the oldest segment lost. During recovery, one
+ * that SACKs nothing new still tells the congestion control that a segment
+ * left the network.
+ * @param sock The socket.
+ * @param sacked The number of segments the ACK newly SACKed.
+ */
+static void on_dup_ack(foggy_socket_t* sock, uint32_t sacked) {
+    window_t* win = &(sock->window);
+    send_window_ring_t* swnd = &(sock->send_window);
+
+    win->dup_ack_count++;
+    if (win->reno_state == RENO_FAST_RECOVERY) {
+        if (sacked == 0) {
+            cc_on_ack(sock, 0, -1);
+        }
+        return;
+    }
+    // After a timeout, the duplicates of what was sent before it must not
+    // start a recovery (RFC 6582, step 2).
+    if (before(win->send_base, win->recovery_point)) {
+        return;
+    }
+    if (win->dup_ack_count >= DUP_ACK_THRESHOLD ||
+        (swnd_front(swnd)->flags & SWND_LOST)) {
+        enter_fast_recovery(sock);
+    }
+}
+
 /**
  * Met  jour les informations du socket pour un paquet reu.
  * @param sock Le socket.
@@ -59,24 +462,93 @@ void on_recv_pkt(foggy_socket_t* sock, uint8_t* pkt) {
     debug_printf("Received packet\n");
     foggy_tcp_header_t* hdr = (foggy_tcp_header_t*)pkt;
     uint8_t flags = get_flags(hdr);
+    uint32_t tsval, tsecr;
+    int has_ts;
+
+    if (flags & SYN_FLAG_MASK) {
+        on_syn(sock, hdr);
+        return;
+    }
+    has_ts = sock->ts_enabled && opt_get_timestamp(get_extension_data(hdr),
+        get_extension_length(hdr), &tsval, &tsecr);
+
+    if (sock->state != TCP_ESTABLISHED) {
+        // Listener: the ACK of our SYN-ACK, or data that carries it,
+        // completes the handshake.
+        if (sock->state != TCP_SYN_RCVD || !(flags & ACK_FLAG_MASK) ||
+            get_ack(hdr) != sock->window.send_base + 1) {
+            return;
+        }
+        establish(sock);
+        if (has_ts) {
+            sample_rtt_ts(sock, tsecr);
+        }
+    }
+
+    // Old duplicate: drop it, but acknowledge data so that the peer learns
+    // where we are (RFC 7323, 5.3).
+    if (has_ts) {
+        if (paws_reject(sock, tsval)) {
+            if (get_payload_len(pkt) > 0) {
+                send_ack(sock);
+            }
+            return;
+        }
+        update_ts_recent(sock, get_seq(hdr), tsval);
+    }
 
     // --- Gestion ACK (Ct metteur) ---
     if (flags & ACK_FLAG_MASK) {
         uint32_t ack = get_ack(hdr);
-        printf("Receive ACK %d\n", ack);
+        uint32_t adv_window = get_advertised_window(hdr) << sock->snd_wscale;
+        uint32_t sacked;
+        int64_t rtt = -1;
+        swnd_rate_sample_t rs;
+        debug_printf("Receive ACK %d\n", ack);
 
-        sock->window.advertised_window = get_advertised_window(hdr);
+        // The ACK acknowledges data never sent (RFC 9293, 3.10.7.4): drop
+        // the segment rather than let send_base run past next_seq_num.
+        if (after(ack, sock->window.next_seq_num)) {
+            debug_printf("Ignoring ACK %d beyond %d\n", ack, sock->window.next_seq_num);
+            return;
+        }
+
+        swnd_rate_begin(&(sock->send_window), get_time_in_ns());
+
+        // 0. Noter dans le tableau de bord les segments que le pair dtient
+        // dj ; transmit_send_window() renverra ensuite les trous.
+        sacked = update_scoreboard(sock, hdr);
+
+        // Un ACK dupliqu ne porte pas de donnes, n'avance pas et ne change
+        // pas la fentre, alors que des donnes sont en vol (RFC 5681).
+        if (ack == sock->window.send_base && get_payload_len(pkt) == 0 &&
+            adv_window == sock->window.advertised_window &&
+            swnd_out(&(sock->send_window)) > 0) {
+            on_dup_ack(sock, sacked);
+        }
+        sock->window.advertised_window = adv_window;
 
         // 1. Vrifier si l'ACK est nouveau et fait avancer la fentre.
         if (after(ack, sock->window.send_base)) {
+            uint32_t acked = ack - sock->window.send_base;
+
+            // With timestamps, every ACK that acknowledges new data gives a
+            // sample, retransmissions included.
+            if (has_ts) {
+                rtt = sample_rtt_ts(sock, tsecr);
+            }
+            else {
+                rtt = sample_rtt(sock, ack);
+            }
             // 2. Mettre  jour la base de la fentre
             sock->window.send_base = ack;
 
             // 3. Purger les paquets acquitts de la file d'envoi (send_window)
             receive_send_window(sock);
+            on_new_ack(sock, acked, rtt);
 
             // 4. Redmarrer le timer s'il reste des paquets non acquitts
-            if (!sock->send_window.empty()) {
+            if (!swnd_empty(&(sock->send_window))) {
                 start_retransmit_timer(sock);
             }
             else {
@@ -84,6 +556,12 @@ void on_recv_pkt(foggy_socket_t* sock, uint8_t* pkt) {
             }
         }
 
+        // 5. Le dbit de livraison mesur par cet ACK.
+        if (swnd_rate_sample(&(sock->send_window), &rs) > 0) {
+            rs.rtt = rtt;
+            cc_cong_control(sock, &rs);
+        }
+
         // Si l'ACK reu contenait des donnes, il faut aussi le traiter comme un paquet de donnes
         if (!(flags & DATA_FLAG_MASK) && get_payload_len(pkt) == 0) return;
     }
@@ -92,62 +570,137 @@ void on_recv_pkt(foggy_socket_t* sock, uint8_t* pkt) {
     if (get_payload_len(pkt) > 0) {
         debug_printf("Received data packet %d, expected %d\n", get_seq(hdr), sock->window.next_seq_expected);
 
-        sock->window.advertised_window = get_advertised_window(hdr);
-
-        // La logique GBN/SR du rcepteur doit tre ici. 
-        // Pour l'instant, on laisse l'implmentation de base qui vrifie si get_seq(hdr) == sock->window.next_seq_expected.
+        sock->window.advertised_window =
+            get_advertised_window(hdr) << sock->snd_wscale;
 
         add_receive_window(sock, pkt);
         process_receive_window(sock);
 
         // Envoyer ACK pour le paquet le plus haut en squence qui a t reu en ordre.
-        debug_printf("Sending ACK packet %d\n", sock->window.next_seq_expected);
-
-        uint8_t* ack_pkt = create_packet(
-            sock->my_port, ntohs(sock->conn.sin_port),
-            sock->window.next_seq_num, sock->window.next_seq_expected, // Seq/Ack
-            sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t), ACK_FLAG_MASK,
-            MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0,
-            NULL, NULL, 0);
-        sendto(sock->socket, ack_pkt, sizeof(foggy_tcp_header_t), 0,
-            (struct sockaddr*)&(sock->conn), sizeof(sock->conn));
-        free(ack_pkt);
+        send_ack(sock);
     }
 }
 
 /**
- * Prpare les donnes pour l'envoi et dclenche la transmission des paquets dans la fentre.
+ * Sends an ACK for the highest in-order sequence number received, with the
+ * current receive window.
  * @param sock Le socket.
- * @param data Les donnes  envoyer.
- * @param buf_len La longueur des donnes.
  */
-void send_pkts(foggy_socket_t* sock, uint8_t* data, int buf_len) {
-    uint8_t* data_offset = data;
+void send_ack(foggy_socket_t* sock) {
+    // Before the handshake there is nothing to acknowledge, nor anyone to
+    // tell.
+    if (sock->state != TCP_ESTABLISHED) {
+        return;
+    }
+    debug_printf("Sending ACK packet %d\n", sock->window.next_seq_expected);
+
+    sack_block_t blocks[OPT_SACK_MAX_BLOCKS];
+    uint8_t ext[OPT_TIMESTAMP_SIZE + OPT_SACK_MAX_SIZE];
+    uint16_t ext_len;
+    int count = 0;
+
+    // SACK blocks: the run that holds the latest segment first (RFC 2018),
+    // then the lowest ones, which hold the oldest holes back.
+    for (int i = 0; i < sock->receive_window_count; ++i) {
+        receive_window_slot_t* run = &(sock->receive_window[i]);
+        if (!before(sock->receive_window_recent, run->seq) &&
+            before(sock->receive_window_recent, run->end)) {
+            blocks[count].start = run->seq;
+            blocks[count].end = run->end;
+            count++;
+            break;
+        }
+    }
+    for (int i = 0; i < sock->receive_window_count &&
+        count < OPT_SACK_MAX_BLOCKS; ++i) {
+        receive_window_slot_t* run = &(sock->receive_window[i]);
+        if (count > 0 && run->seq == blocks[0].start) {
+            continue;
+        }
+        blocks[count].start = run->seq;
+        blocks[count].end = run->end;
+        count++;
+    }
+    ext_len = put_timestamp(sock, ext);
+    ext_len += opt_put_sack(ext + ext_len, blocks, count);
+
+    uint8_t* ack_pkt = pool_create_packet(&(sock->shard->pool),
+        sock->my_port, ntohs(sock->conn.sin_port),
+        sock->window.next_seq_num, sock->window.next_seq_expected, // Seq/Ack
+        sizeof(foggy_tcp_header_t) + ext_len,
+        sizeof(foggy_tcp_header_t) + ext_len, ACK_FLAG_MASK,
+        get_receive_window(sock), ext_len,
+        ext, NULL, 0);
+    // Out of buffers: the peer sends again, or a later ACK covers this one.
+    if (ack_pkt == NULL) {
+        perror("ERROR allocating ACK");
+        return;
+    }
+    queue_pkt(sock, ack_pkt, 1);
+}
+
+void send_syn(foggy_socket_t* sock) {
+    uint8_t ext[OPT_TIMESTAMP_SIZE + OPT_WSCALE_SIZE];
+    uint16_t ext_len;
+    uint8_t flags = SYN_FLAG_MASK;
+    uint32_t ack = 0;
+
+    // The SYN-ACK echoes the TSval of the SYN; the SYN has none to echo.
+    ext_len = put_timestamp(sock, ext);
+    if (sock->ws_enabled) {
+        ext_len += opt_put_wscale(ext + ext_len, sock->rcv_wscale);
+    }
+    if (sock->state == TCP_SYN_RCVD) {
+        flags |= ACK_FLAG_MASK;
+        ack = sock->window.next_seq_expected;
+    }
+    debug_printf("Sending SYN %d\n", sock->window.send_base);
 
+    uint8_t* syn_pkt = pool_create_packet(&(sock->shard->pool),
+        sock->my_port, ntohs(sock->conn.sin_port),
+        sock->window.send_base, ack, // Seq/Ack
+        sizeof(foggy_tcp_header_t) + ext_len,
+        sizeof(foggy_tcp_header_t) + ext_len, flags,
+        get_receive_window(sock), ext_len,
+        ext, NULL, 0);
+    // Out of buffers: the retransmission timer sends the SYN again.
+    if (syn_pkt == NULL) {
+        perror("ERROR allocating SYN");
+    }
+    else {
+        queue_pkt(sock, syn_pkt, 1);
+    }
+    start_retransmit_timer(sock);
+}
+
+/**
+ * Prpare les donnes pour l'envoi et dclenche la transmission des paquets dans la fentre.
+ * @param sock Le socket.
+ * @param buf_len The number of bytes of the send ring to segment.
+ */
+void send_pkts(foggy_socket_t* sock, int buf_len) {
     // 1. Mettre les donnes dans le buffer d'envoi (tant que buf_len > 0)
     if (buf_len > 0) {
         while (buf_len != 0) {
             uint16_t payload_len = MIN(buf_len, (int)MSS);
 
-            send_window_slot_t slot;
-            slot.is_sent = 0;
-
-            // Cre le paquet avec le SeqNum actuel (sock->window.next_seq_num)
-            slot.msg = create_packet(
-                sock->my_port, ntohs(sock->conn.sin_port),
-                sock->window.next_seq_num, sock->window.next_seq_expected, // Seq/Ack
-                sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t) + payload_len,
-                ACK_FLAG_MASK,
-                MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0, NULL,
-                data_offset, payload_len);
-
-            sock->send_window.push_back(slot);
+            // Growing the window moves the headers the transmit batch may
+            // point to: send them first.
+            if (swnd_full(&(sock->send_window))) {
+                flush_pkts(sock);
+            }
+            // The header is built when the segment is transmitted; the
+            // payload is not copied, it is sent from the send ring.
+            if (swnd_push(&(sock->send_window), sock->window.next_seq_num,
+                payload_len) == NULL) {
+                perror("ERROR growing send window");
+                break;
+            }
 
             // Avancer le NextSeqNum pour le paquet suivant
             sock->window.next_seq_num += payload_len;
 
             buf_len -= payload_len;
-            data_offset += payload_len;
             // NOTE: Le champ last_byte_sent n'est plus pertinent ici, il est gr par next_seq_num
             // sock->window.last_byte_sent += payload_len; 
         }
@@ -158,123 +711,319 @@ void send_pkts(foggy_socket_t* sock, uint8_t* data, int buf_len) {
 }
 
 
+/**
+ * Returns the rate to pace segments at in bytes per second, 0 to send them as
+ * fast as the window allows: the one of the congestion control algorithm,
+ * capped by FOGGY_OPT_PACING_RATE.
+ * @param sock The socket.
+ */
+static uint64_t get_pacing_rate(foggy_socket_t* sock) {
+    uint64_t rate = cc_pacing_rate(sock);
+    uint64_t max = __atomic_load_n(&(sock->max_pacing_rate), __ATOMIC_RELAXED);
+
+    if (rate == 0 || (max != 0 && max < rate)) {
+        rate = max;
+    }
+    return rate;
+}
+
+/**
+ * Returns how many bytes the pacing lets go out now, in one burst: none
+ * before pacing_next, then PACING_BURST_NS worth of the rate.
+ * @param sock The socket.
+ * @param rate The pacing rate, not 0.
+ */
+static uint32_t pacing_budget(foggy_socket_t* sock, uint64_t rate) {
+    int64_t now = get_time_in_ns();
+
+    if (now < sock->pacing_next) {
+        return 0;
+    }
+    // The timer may fire late: make up for one burst at most, so an idle
+    // socket does not send its whole window at once.
+    sock->pacing_next = MAX(sock->pacing_next, now - PACING_BURST_NS);
+    return MAX(rate * PACING_BURST_NS / 1000000000, PACING_MIN_BURST);
+}
+
+/**
+ * Takes a segment of `len` bytes out of the burst, and moves pacing_next past
+ * its transmission time at the pacing rate.
+ * @param sock The socket.
+ * @param len The payload of the segment.
+ * @param rate The pacing rate, 0 if the socket is not paced.
+ * @param budget The bytes left in the burst.
+ * @return 1 if the segment may be sent now, 0 if it waits for the next burst.
+ */
+static int pace_segment(foggy_socket_t* sock, uint32_t len, uint64_t rate,
+    uint32_t* budget) {
+    if (rate == 0) {
+        return 1;
+    }
+    if (len > *budget) {
+        sock->pacing_wait = 1;
+        return 0;
+    }
+    *budget -= len;
+    sock->pacing_next += (int64_t)len * 1000000000 / rate;
+    return 1;
+}
+
 /**
  * Logique d'envoi actif : envoie tous les paquets qui sont dans la fentre [SendBase, SendBase + WindowSize].
+ * With a pacing rate, the segments leave in bursts spaced by the backend's
+ * timer instead of all at once.
  * @param sock Le socket.
  */
 void transmit_send_window(foggy_socket_t* sock) {
-    if (sock->send_window.empty()) return;
+    send_window_ring_t* swnd = &(sock->send_window);
+    uint64_t rate;
+    uint32_t budget = 0;
 
-    // Dterminer la limite de la fentre d'envoi
-    uint32_t window_limit = sock->window.send_base + (WINDOW_SIZE_DEFAULT * MSS);
-    // Pour le CP2, on utilise une taille fixe, mais en vrai: min(cwnd, advertised_window)
+    sock->pacing_wait = 0;
 
-    // Boucle pour envoyer tous les paquets qui sont DANS la fentre et n'ont pas encore t envoys.
-    std::deque<send_window_slot_t>::iterator it;
-    for (it = sock->send_window.begin(); it != sock->send_window.end(); ++it) {
-        send_window_slot_t& slot = *it;
-        foggy_tcp_header_t* hdr = (foggy_tcp_header_t*)slot.msg;
-        uint32_t current_seq = get_seq(hdr);
+    // Data waits for the handshake.
+    if (sock->state != TCP_ESTABLISHED) return;
+    if (swnd_empty(swnd)) {
+        swnd_app_limited(swnd);
+        return;
+    }
 
-        // 1. Vrification de la fentre : Le paquet est-il dans la fentre autorise ?
-        if (before(current_seq, window_limit)) {
+    // Dterminer la limite de la fentre d'envoi : les donnes en vol sont
+    // limites par min(cwnd, rwnd), les nouvelles donnes par rwnd.
+    uint32_t window = get_send_window(sock);
+    uint32_t window_limit = sock->window.send_base + sock->window.advertised_window;
 
-            // 2. Vrification de l'envoi : Si le paquet n'a pas t envoy.
-            if (slot.is_sent) {
-                continue;
-            }
+    rate = get_pacing_rate(sock);
+    if (rate > 0) {
+        budget = pacing_budget(sock, rate);
+    }
 
-            // ENVOI DU PAQUET
-            debug_printf("Sending packet %d %d\n", current_seq, current_seq + get_payload_len(slot.msg));
-            slot.is_sent = 1;
-            sendto(sock->socket, slot.msg, get_plen(hdr), 0,
-                (struct sockaddr*)&(sock->conn), sizeof(sock->conn));
+    // Boucle pour envoyer, tant que les donnes en vol (pipe) laissent de la
+    // place dans la fentre, d'abord les trous puis les nouveaux paquets
+    // (NextSeg() de RFC 6675).
+    for (;;) {
+        uint32_t pipe = swnd_pipe(swnd);
+        send_window_slot_t* slot = swnd_next_lost(swnd);
 
-            // 3. Gestion du Timer : Si c'est le paquet de base, dmarrer/redmarrer le timer.
-            if (current_seq == sock->window.send_base) {
+        // 1. Retransmettre le plus ancien segment perdu.
+        if (slot != NULL) {
+            if ((pipe != 0 && pipe + slot->len > window) ||
+                !pace_segment(sock, slot->len, rate, &budget)) {
+                break;
+            }
+            debug_printf("Retransmitting packet %d %d\n", slot->seq, slot->seq + slot->len);
+            transmit_segment(sock, slot);
+            if (slot == swnd_front(swnd)) {
                 start_retransmit_timer(sock);
             }
+            continue;
+        }
+
+        // 2. Sinon, le prochain segment jamais envoy, s'il est dans la
+        // fentre autorise.
+        if (swnd->next_send == swnd->tail) {
+            // The window has room the application does not fill.
+            if (pipe < window) {
+                swnd_app_limited(swnd);
+            }
+            break;
         }
-        else {
+        slot = swnd_at(swnd, swnd->next_send - swnd->head);
+        uint32_t current_seq = slot->seq;
+        if (!before(current_seq, window_limit) ||
+            (pipe != 0 && pipe + slot->len > window)) {
             // Le reste des paquets est hors de la fentre (au-del de la limite).
             break;
         }
+        if (!pace_segment(sock, slot->len, rate, &budget)) {
+            break;
+        }
+
+        // ENVOI DU PAQUET
+        debug_printf("Sending packet %d %d\n", current_seq, current_seq + slot->len);
+        transmit_segment(sock, slot);
+        swnd->next_send++;
+
+        // 3. Gestion du Timer : Si c'est le paquet de base, dmarrer/redmarrer le timer.
+        if (current_seq == sock->window.send_base) {
+            start_retransmit_timer(sock);
+        }
+    }
+
+    // The peer's window is closed: the retransmission timer doubles as the
+    // persist timer, and sends the first segment as a probe when it fires.
+    if (swnd->next_send == swnd->head && !sock->pacing_wait &&
+        sock->window.retransmit_timeout == 0) {
+        start_retransmit_timer(sock);
     }
 }
 
+/**
+ * Returns the window to advertise: the free space of the receive ring, in
+ * units of the negotiated scale, as much of it as the header field can carry.
+ * The window of a SYN is never scaled.
+ * @param sock The socket.
+ */
+uint16_t get_receive_window(foggy_socket_t* sock) {
+    uint8_t shift = sock->state == TCP_ESTABLISHED ? sock->rcv_wscale : 0;
+
+    return MIN(ring_space(&(sock->recv_ring)) >> shift, MAX_NETWORK_BUFFER);
+}
+
+/**
+ * Returns the size of the send window: the congestion window, limited by what
+ * the peer advertised.
+ * @param sock The socket.
+ */
+uint32_t get_send_window(foggy_socket_t* sock) {
+    return MIN(cc_cwnd(sock), sock->window.advertised_window);
+}
+
+/**
+ * Returns how many new bytes the send window can take before it is full.
+ * Segments are cut up to the peer's window; the congestion window only
+ * decides when they are sent.
+ * @param sock The socket.
+ */
+uint32_t send_window_room(foggy_socket_t* sock) {
+    // With a zero window, still queue one segment: it is the window probe.
+    uint32_t window = MAX(sock->window.advertised_window, MSS);
+    uint32_t in_flight = sock->window.next_seq_num - sock->window.send_base;
+
+    return in_flight < window ? window - in_flight : 0;
+}
+
 /**
  * Purge les paquets acquitts et fait avancer la fentre d'envoi.
  * @param sock Le socket.
  */
 void receive_send_window(foggy_socket_t* sock) {
-    uint32_t new_send_base = sock->window.send_base;
-
-    // Boucle pour retirer tous les paquets qui sont entirement couverts par le nouveau SendBase
-    while (!sock->send_window.empty()) {
-        send_window_slot_t slot = sock->send_window.front();
-        foggy_tcp_header_t* hdr = (foggy_tcp_header_t*)slot.msg;
-        uint32_t packet_seq = get_seq(hdr);
-        uint16_t payload_len = get_payload_len(slot.msg);
-
-        // Si la fin du paquet (Seq + Longueur) est <= au nouveau SendBase (ACK), il est acquitt.
-        if (before_or_equal(packet_seq + payload_len, new_send_base)) {
-            // Ce paquet est acquitt, le retirer
-            sock->send_window.pop_front();
-            free(slot.msg);
-        }
-        else {
-            // Le premier paquet restant n'est pas compltement acquitt.
-            break;
-        }
+    send_window_ring_t* swnd = &(sock->send_window);
+    uint32_t acked;
+
+    if (swnd_empty(swnd)) {
+        return;
+    }
+    // Les paquets acquitts sont ceux qui prcdent le segment contenant le
+    // nouveau SendBase (ACK); s'il n'y en a pas, tous le sont.
+    acked = swnd_find(swnd, sock->window.send_base, MSS);
+    if (acked == 0) {
+        return;
     }
+    // The packets may still sit in the transmit batch (after a
+    // retransmission); send them before releasing their memory.
+    flush_pkts(sock);
+    swnd_pop(swnd, acked);
+    release_send_ring(sock);
 }
 
-// ----------------------------------------------------------------------
-// Les fonctions suivantes (add_receive_window, process_receive_window) 
-// doivent tre mises  jour pour la logique du rcepteur GBN, mais pour 
-// l'instant, on garde la logique de base du starter code qui vrifie 
-// seulement le SeqNum attendu (next_seq_expected).
-// ----------------------------------------------------------------------
+/**
+ * Copies into the receive ring the bytes [seq, end) of a segment whose payload
+ * starts at sequence number `payload_seq`.
+ * @param sock The socket.
+ */
+static void store_payload(foggy_socket_t* sock, uint32_t seq, uint32_t end,
+    uint32_t payload_seq, const uint8_t* payload) {
+    ring_write_at(&(sock->recv_ring), seq - sock->window.next_seq_expected,
+        payload + (seq - payload_seq), end - seq);
+}
 
+/**
+ * Selective repeat: stores the payload of a segment in the receive ring at
+ * its place, whether it arrived in order or not. Only the bytes not held yet
+ * are copied, and the run they make is merged with its neighbours.
+ * @param sock Le socket.
+ * @param pkt Le paquet de donnes reu.
+ */
 void add_receive_window(foggy_socket_t* sock, uint8_t* pkt) {
-    // ... (Garder l'implmentation Stop-and-wait temporaire)
     foggy_tcp_header_t* hdr = (foggy_tcp_header_t*)pkt;
+    receive_window_slot_t* runs = sock->receive_window;
+    uint32_t expected = sock->window.next_seq_expected;
+    uint32_t payload_seq = get_seq(hdr);
+    uint32_t seq = payload_seq;
+    uint32_t end = seq + get_payload_len(pkt);
+    uint32_t limit = expected + ring_space(&(sock->recv_ring));
+    uint32_t pos;
+    int lo, hi, i;
 
-    // Stop-and-wait implementation
-    receive_window_slot_t* cur_slot = &(sock->receive_window[0]);
-    if (cur_slot->is_used == 0) {
-        cur_slot->is_used = 1;
-        cur_slot->msg = (uint8_t*)malloc(get_plen(hdr));
-        memcpy(cur_slot->msg, pkt, get_plen(hdr));
+    // Keep only what falls in the window: bytes before it were delivered
+    // already, bytes after it have no room.
+    if (before(seq, expected)) {
+        seq = expected;
     }
-}
+    if (after(end, limit)) {
+        end = limit;
+    }
+    if (!before(seq, end)) {
+        return;
+    }
+    sock->receive_window_recent = seq;
 
-void process_receive_window(foggy_socket_t* sock) {
-    // ... (Garder l'implmentation Stop-and-wait temporaire)
-    receive_window_slot_t* cur_slot = &(sock->receive_window[0]);
-    if (cur_slot->is_used != 0) {
-        foggy_tcp_header_t* hdr = (foggy_tcp_header_t*)cur_slot->msg;
-
-        // GBN Rcepteur: Si le paquet n'est pas celui attendu, on le DISCARDE.
-        if (get_seq(hdr) != sock->window.next_seq_expected) {
-            debug_printf("Discarding out-of-order packet %d, expected %d\n", get_seq(hdr), sock->window.next_seq_expected);
+    // Runs [lo, hi) overlap or touch [seq, end).
+    for (lo = 0; lo < sock->receive_window_count &&
+        before(runs[lo].end, seq); ++lo) {
+    }
+    for (hi = lo; hi < sock->receive_window_count &&
+        before_or_equal(runs[hi].seq, end); ++hi) {
+    }
+
+    if (lo == hi) {
+        if (sock->receive_window_count == RECEIVE_WINDOW_SLOT_SIZE) {
+            // No slot to remember the run: drop it, unless it is in order,
+            // in which case it is delivered at once.
+            if (seq != expected) {
+                return;
+            }
+            store_payload(sock, seq, end, payload_seq, get_payload(pkt));
+            ring_commit(&(sock->recv_ring), end - seq);
+            sock->window.next_seq_expected = end;
             return;
         }
+        store_payload(sock, seq, end, payload_seq, get_payload(pkt));
+        memmove(&runs[lo + 1], &runs[lo],
+            (sock->receive_window_count - lo) * sizeof(*runs));
+        runs[lo].seq = seq;
+        runs[lo].end = end;
+        sock->receive_window_count++;
+        return;
+    }
 
-        // Le paquet est celui attendu (in-order)
-        uint16_t payload_len = get_payload_len(cur_slot->msg);
-        sock->window.next_seq_expected += payload_len; // Avancer le pointeur ACK
+    // Copy the holes between the runs, then make them one run.
+    pos = seq;
+    for (i = lo; i < hi; ++i) {
+        if (before(pos, runs[i].seq)) {
+            store_payload(sock, pos, runs[i].seq, payload_seq, get_payload(pkt));
+        }
+        if (after(runs[i].end, pos)) {
+            pos = runs[i].end;
+        }
+    }
+    if (before(pos, end)) {
+        store_payload(sock, pos, end, payload_seq, get_payload(pkt));
+    }
+    if (before(seq, runs[lo].seq)) {
+        runs[lo].seq = seq;
+    }
+    runs[lo].end = after(runs[hi - 1].end, end) ? runs[hi - 1].end : end;
+    memmove(&runs[lo + 1], &runs[hi],
+        (sock->receive_window_count - hi) * sizeof(*runs));
+    sock->receive_window_count -= hi - lo - 1;
+}
 
-        // Copier vers received_buf
-        sock->received_buf = (uint8_t*)
-            realloc(sock->received_buf, sock->received_len + payload_len);
-        memcpy(sock->received_buf + sock->received_len, get_payload(cur_slot->msg),
-            payload_len);
-        sock->received_len += payload_len;
+/**
+ * Hands the application, in one step, the run of bytes that starts at
+ * next_seq_expected, if there is one.
+ * @param sock Le socket.
+ */
+void process_receive_window(foggy_socket_t* sock) {
+    receive_window_slot_t* runs = sock->receive_window;
 
-        // Librer le slot
-        cur_slot->is_used = 0;
-        free(cur_slot->msg);
-        cur_slot->msg = NULL;
+    if (sock->receive_window_count == 0 ||
+        runs[0].seq != sock->window.next_seq_expected) {
+        return;
     }
-}
\ No newline at end of file
+    ring_commit(&(sock->recv_ring), runs[0].end - runs[0].seq);
+    sock->window.next_seq_expected = runs[0].end;
+    sock->receive_window_count--;
+    memmove(&runs[0], &runs[1], sock->receive_window_count * sizeof(*runs));
+}
@@ -0,0 +1,139 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the encoding of the header extension options.
+ */
+
+#include "foggy_option.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "foggy_packet.h"
+#include "grading.h"
+
+// MSS in foggy_packet.h spells out the size of the option.
+static_assert(MSS == MAX_LEN - sizeof(foggy_tcp_header_t) - OPT_TIMESTAMP_SIZE,
+              "MSS does not leave room for the timestamp option");
+
+/**
+ * Reads a 32-bit field in network order, wherever it is aligned.
+ */
+static uint32_t get_u32(const uint8_t* p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+/**
+ * Writes a 32-bit field in network order, wherever it is aligned.
+ */
+static void put_u32(uint8_t* p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+const uint8_t* opt_find(const uint8_t* ext, uint16_t ext_len, uint8_t kind,
+    uint8_t* len) {
+    uint16_t off = 0;
+
+    while (off + 2 <= ext_len) {
+        uint8_t opt_len = ext[off + 1];
+
+        if (opt_len < 2 || off + opt_len > ext_len) {
+            return NULL;
+        }
+        if (ext[off] == kind) {
+            *len = opt_len - 2;
+            return ext + off + 2;
+        }
+        off += opt_len;
+    }
+    return NULL;
+}
+
+uint16_t opt_put_sack(uint8_t* ext, const sack_block_t* blocks, int count) {
+    if (count > OPT_SACK_MAX_BLOCKS) {
+        count = OPT_SACK_MAX_BLOCKS;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+    ext[0] = OPT_KIND_SACK;
+    ext[1] = 2 + 8 * count;
+    for (int i = 0; i < count; ++i) {
+        put_u32(ext + 2 + 8 * i, blocks[i].start);
+        put_u32(ext + 6 + 8 * i, blocks[i].end);
+    }
+    return ext[1];
+}
+
+int opt_get_sack(const uint8_t* ext, uint16_t ext_len, sack_block_t* blocks) {
+    const uint8_t* value;
+    uint8_t len;
+    int count;
+
+    value = opt_find(ext, ext_len, OPT_KIND_SACK, &len);
+    if (value == NULL) {
+        return 0;
+    }
+    count = len / 8;
+    if (count > OPT_SACK_MAX_BLOCKS) {
+        count = OPT_SACK_MAX_BLOCKS;
+    }
+    for (int i = 0; i < count; ++i) {
+        blocks[i].start = get_u32(value + 8 * i);
+        blocks[i].end = get_u32(value + 8 * i + 4);
+    }
+    return count;
+}
+
+uint16_t opt_put_timestamp(uint8_t* ext, uint32_t tsval, uint32_t tsecr) {
+    ext[0] = OPT_KIND_TIMESTAMP;
+    ext[1] = OPT_TIMESTAMP_SIZE;
+    put_u32(ext + 2, tsval);
+    put_u32(ext + 6, tsecr);
+    return OPT_TIMESTAMP_SIZE;
+}
+
+int opt_get_timestamp(const uint8_t* ext, uint16_t ext_len, uint32_t* tsval,
+    uint32_t* tsecr) {
+    const uint8_t* value;
+    uint8_t len;
+
+    value = opt_find(ext, ext_len, OPT_KIND_TIMESTAMP, &len);
+    if (value == NULL || len != OPT_TIMESTAMP_SIZE - 2) {
+        return 0;
+    }
+    *tsval = get_u32(value);
+    *tsecr = get_u32(value + 4);
+    return 1;
+}
+
+uint16_t opt_put_wscale(uint8_t* ext, uint8_t shift) {
+    ext[0] = OPT_KIND_WSCALE;
+    ext[1] = OPT_WSCALE_SIZE;
+    ext[2] = shift;
+    return OPT_WSCALE_SIZE;
+}
+
+int opt_get_wscale(const uint8_t* ext, uint16_t ext_len, uint8_t* shift) {
+    const uint8_t* value;
+    uint8_t len;
+
+    value = opt_find(ext, ext_len, OPT_KIND_WSCALE, &len);
+    if (value == NULL || len != OPT_WSCALE_SIZE - 2) {
+        return 0;
+    }
+    // Larger shifts are taken as the largest one (RFC 7323, 2.3).
+    *shift = value[0] > OPT_WSCALE_MAX ? OPT_WSCALE_MAX : value[0];
+    return 1;
+}
@@ -0,0 +1,100 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the packet buffer pool. Buffers are carved out of
+ * cache-line-aligned slabs and kept on an intrusive free list, so getting and
+ * putting a buffer is O(1). The pool grows by a slab when it runs dry and
+ * never shrinks: its size follows the peak number of packets in flight.
+ */
+
+#include "foggy_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void pool_init(pkt_pool_t* pool) {
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool->total_count = 0;
+    pool->slabs.clear();
+}
+
+void pool_destroy(pkt_pool_t* pool) {
+    for (size_t i = 0; i < pool->slabs.size(); ++i) {
+        free(pool->slabs[i]);
+    }
+    pool_init(pool);
+}
+
+/**
+ * Adds a slab of POOL_SLAB_COUNT buffers to the free list.
+ *
+ * @return 0 on success, -1 if memory is short.
+ */
+static int pool_grow(pkt_pool_t* pool) {
+    uint8_t* slab =
+        (uint8_t*)aligned_alloc(POOL_ALIGN, POOL_SLAB_COUNT * POOL_BUF_SIZE);
+
+    if (slab == NULL) {
+        return -1;
+    }
+    pool->slabs.push_back(slab);
+    for (int i = POOL_SLAB_COUNT - 1; i >= 0; --i) {
+        pool_put(pool, slab + i * POOL_BUF_SIZE);
+    }
+    pool->total_count += POOL_SLAB_COUNT;
+    return 0;
+}
+
+uint8_t* pool_get(pkt_pool_t* pool) {
+    uint8_t* buf;
+
+    if (pool->free_list == NULL && pool_grow(pool) < 0) {
+        return NULL;
+    }
+    buf = pool->free_list;
+    memcpy(&(pool->free_list), buf, sizeof(uint8_t*));
+    pool->free_count--;
+    return buf;
+}
+
+void pool_put(pkt_pool_t* pool, uint8_t* buf) {
+    memcpy(buf, &(pool->free_list), sizeof(uint8_t*));
+    pool->free_list = buf;
+    pool->free_count++;
+}
+
+uint8_t* pool_create_packet(pkt_pool_t* pool, uint16_t src, uint16_t dst,
+    uint32_t seq, uint32_t ack, uint16_t hlen, uint16_t plen, uint8_t flags,
+    uint16_t adv_window, uint16_t ext_len, uint8_t* ext_data, uint8_t* payload,
+    uint16_t payload_len) {
+    uint8_t* packet;
+
+    if (hlen < sizeof(foggy_tcp_header_t) || plen < hlen ||
+        sizeof(foggy_tcp_header_t) + ext_len + payload_len > POOL_BUF_SIZE) {
+        return NULL;
+    }
+    packet = pool_get(pool);
+    if (packet == NULL) {
+        return NULL;
+    }
+
+    // set_header() only knows the fixed header: the extension goes right
+    // after it, where get_payload() expects it.
+    set_header((foggy_tcp_header_t*)packet, src, dst, seq, ack, hlen, plen,
+        flags, adv_window, 0, NULL);
+    set_extension_length((foggy_tcp_header_t*)packet, ext_len);
+    if (ext_len > 0) {
+        memcpy(get_extension_data((foggy_tcp_header_t*)packet), ext_data,
+            ext_len);
+    }
+    set_payload(packet, payload, payload_len);
+    return packet;
+}
@@ -0,0 +1,166 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the single-producer/single-consumer byte ring. `head`
+ * and `tail` run freely and wrap around 2^32; the storage offset of a counter
+ * is `counter & mask`. The writer publishes bytes with a release store of
+ * `tail` and the reader frees room with a release store of `head`.
+ *
+ * A side about to sleep raises its `*_waiting` flag, then checks the counter
+ * of the other side again before sleeping on it. The other side updates its
+ * counter, then checks the flag. Both sequences are fenced, so either the
+ * sleeper sees the new counter (and the futex refuses to sleep), or the other
+ * side sees the flag and wakes it.
+ */
+
+#include "foggy_ring.h"
+
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+int ring_init(byte_ring_t* ring, uint32_t capacity) {
+    uint32_t size = 1;
+
+    memset(ring, 0, sizeof(*ring));
+    if (capacity == 0 || capacity > RING_MAX_CAPACITY) {
+        return -1;
+    }
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->data = (uint8_t*)malloc(size);
+    if (ring->data == NULL) {
+        return -1;
+    }
+    ring->capacity = size;
+    ring->mask = size - 1;
+    return 0;
+}
+
+void ring_destroy(byte_ring_t* ring) {
+    free(ring->data);
+    memset(ring, 0, sizeof(*ring));
+}
+
+uint32_t ring_used(const byte_ring_t* ring) {
+    return __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+}
+
+uint32_t ring_space(const byte_ring_t* ring) {
+    return ring->capacity - ring_used(ring);
+}
+
+uint32_t ring_write(byte_ring_t* ring, const uint8_t* data, uint32_t len) {
+    len = ring_write_at(ring, 0, data, len);
+    ring_commit(ring, len);
+    return len;
+}
+
+uint32_t ring_write_at(byte_ring_t* ring, uint32_t offset, const uint8_t* data,
+    uint32_t len) {
+    uint32_t space = ring_space(ring);
+    uint32_t off = (ring->tail + offset) & ring->mask;
+    uint32_t first;
+
+    if (offset >= space) {
+        return 0;
+    }
+    len = MIN(len, space - offset);
+    first = MIN(len, ring->capacity - off);
+    memcpy(ring->data + off, data, first);
+    memcpy(ring->data, data + first, len - first);
+    return len;
+}
+
+void ring_commit(byte_ring_t* ring, uint32_t len) {
+    __atomic_store_n(&(ring->tail), ring->tail + len, __ATOMIC_RELEASE);
+}
+
+uint32_t ring_read(byte_ring_t* ring, uint8_t* data, uint32_t len) {
+    uint32_t head = ring->head;
+    uint32_t off = head & ring->mask;
+    uint32_t first;
+
+    len = MIN(len, ring_used(ring));
+    first = MIN(len, ring->capacity - off);
+    memcpy(data, ring->data + off, first);
+    memcpy(data + first, ring->data, len - first);
+    __atomic_store_n(&(ring->head), head + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+uint32_t ring_peek(const byte_ring_t* ring, uint32_t offset, uint8_t** data) {
+    uint32_t used = ring_used(ring);
+    uint32_t off = (ring->head + offset) & ring->mask;
+
+    *data = ring->data + off;
+    if (offset >= used) {
+        return 0;
+    }
+    return MIN(used - offset, ring->capacity - off);
+}
+
+void ring_consume(byte_ring_t* ring, uint32_t len) {
+    __atomic_store_n(&(ring->head), ring->head + len, __ATOMIC_RELEASE);
+}
+
+void ring_wait_data(byte_ring_t* ring) {
+    uint32_t tail;
+
+    while ((tail = __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE)) ==
+        ring->head) {
+        __atomic_store_n(&(ring->reader_waiting), 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(ring->tail), __ATOMIC_SEQ_CST) == tail) {
+            futex_wait(&(ring->tail), tail);
+        }
+        __atomic_store_n(&(ring->reader_waiting), 0, __ATOMIC_RELAXED);
+    }
+}
+
+void ring_wait_space(byte_ring_t* ring) {
+    uint32_t head;
+
+    while (ring->tail - (head = __atomic_load_n(&(ring->head),
+        __ATOMIC_ACQUIRE)) == ring->capacity) {
+        __atomic_store_n(&(ring->writer_waiting), 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(ring->head), __ATOMIC_SEQ_CST) == head) {
+            futex_wait(&(ring->head), head);
+        }
+        __atomic_store_n(&(ring->writer_waiting), 0, __ATOMIC_RELAXED);
+    }
+}
+
+void ring_wake_reader(byte_ring_t* ring) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(ring->reader_waiting), __ATOMIC_RELAXED)) {
+        futex_wake(&(ring->tail));
+    }
+}
+
+void ring_wake_writer(byte_ring_t* ring) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(ring->writer_waiting), __ATOMIC_RELAXED)) {
+        futex_wake(&(ring->head));
+    }
+}
+
+void futex_wait(uint32_t* addr, uint32_t val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+void futex_wake(uint32_t* addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
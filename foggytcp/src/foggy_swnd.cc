@@ -0,0 +1,393 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the send window ring. `head`, `tail` and `next_send`
+ * count slots and run freely; the storage index of a counter is
+ * `counter & mask`. Segments are pushed in sequence order and never overlap,
+ * so the slots are sorted on `seq`.
+ *
+ * Every scoreboard flag change goes through this file, which keeps the byte
+ * counts of the flags in step. A slot is in flight once for being sent and
+ * not SACKed nor lost, and once more for being retransmitted, as in Linux.
+ * It also counts the bytes delivered, the first time a slot is SACKed or
+ * cumulatively acknowledged.
+ */
+
+#include "foggy_swnd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Allocates the storage of a window of `capacity` slots, and moves the
+ * segments of `swnd` into it, oldest first at index 0.
+ *
+ * @return 0 on success, -1 if memory is short.
+ */
+static int swnd_resize(send_window_ring_t* swnd, uint32_t capacity) {
+    send_window_slot_t* slots =
+        (send_window_slot_t*)malloc(capacity * sizeof(*slots));
+    uint8_t (*hdrs)[SWND_HDR_SIZE] =
+        (uint8_t (*)[SWND_HDR_SIZE])malloc(capacity * SWND_HDR_SIZE);
+    uint32_t count = swnd_count(swnd);
+
+    if (slots == NULL || hdrs == NULL) {
+        free(slots);
+        free(hdrs);
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t from = (swnd->head + i) & swnd->mask;
+        slots[i] = swnd->slots[from];
+        memcpy(hdrs[i], swnd->hdrs[from], SWND_HDR_SIZE);
+    }
+    free(swnd->slots);
+    free(swnd->hdrs);
+    swnd->slots = slots;
+    swnd->hdrs = hdrs;
+    swnd->capacity = capacity;
+    swnd->mask = capacity - 1;
+    swnd->next_send -= swnd->head;
+    swnd->high_sacked -= swnd->head;
+    swnd->lost_hint -= swnd->head;
+    swnd->retrans_hint -= swnd->head;
+    swnd->head = 0;
+    swnd->tail = count;
+    return 0;
+}
+
+int swnd_init(send_window_ring_t* swnd) {
+    memset(swnd, 0, sizeof(*swnd));
+    return swnd_resize(swnd, SWND_INITIAL_SLOTS);
+}
+
+void swnd_destroy(send_window_ring_t* swnd) {
+    free(swnd->slots);
+    free(swnd->hdrs);
+    memset(swnd, 0, sizeof(*swnd));
+}
+
+uint32_t swnd_count(const send_window_ring_t* swnd) {
+    return swnd->tail - swnd->head;
+}
+
+int swnd_empty(const send_window_ring_t* swnd) {
+    return swnd->tail == swnd->head;
+}
+
+send_window_slot_t* swnd_at(const send_window_ring_t* swnd, uint32_t i) {
+    return &(swnd->slots[(swnd->head + i) & swnd->mask]);
+}
+
+send_window_slot_t* swnd_front(const send_window_ring_t* swnd) {
+    return &(swnd->slots[swnd->head & swnd->mask]);
+}
+
+uint8_t* swnd_hdr(const send_window_ring_t* swnd,
+    const send_window_slot_t* slot) {
+    return swnd->hdrs[slot - swnd->slots];
+}
+
+int swnd_full(const send_window_ring_t* swnd) {
+    return swnd_count(swnd) == swnd->capacity;
+}
+
+send_window_slot_t* swnd_push(send_window_ring_t* swnd, uint32_t seq,
+    uint16_t len) {
+    send_window_slot_t* slot;
+
+    if (swnd_full(swnd) && swnd_resize(swnd, swnd->capacity * 2) < 0) {
+        return NULL;
+    }
+    slot = &(swnd->slots[swnd->tail & swnd->mask]);
+    slot->send_time = 0;
+    slot->seq = seq;
+    slot->len = len;
+    slot->flags = 0;
+    slot->retransmits = 0;
+    slot->delivered = 0;
+    slot->delivered_time = 0;
+    slot->first_sent_time = 0;
+    swnd->tail++;
+    return slot;
+}
+
+/**
+ * Counts a slot as delivered, and makes it the base of the rate sample of the
+ * ACK if it is the newest one sent that the ACK delivers.
+ */
+static void deliver(send_window_ring_t* swnd, const send_window_slot_t* slot) {
+    swnd->delivered += slot->len;
+    swnd->delivered_time = swnd->rs_now;
+    if (swnd->rs_newly == 0 || slot->send_time > swnd->rs_send_time) {
+        swnd->rs_send_time = slot->send_time;
+        swnd->rs_prior_time = slot->delivered_time;
+        swnd->rs_prior_delivered = slot->delivered;
+        swnd->rs_send_elapsed = slot->send_time - slot->first_sent_time;
+        swnd->rs_ack_elapsed = swnd->delivered_time - slot->delivered_time;
+        swnd->rs_app_limited = (slot->flags & SWND_APP_LIMITED) != 0;
+        swnd->first_sent_time = slot->send_time;
+    }
+    swnd->rs_newly += slot->len;
+}
+
+/**
+ * Returns `counter`, or `head` if the counter points before it.
+ */
+static uint32_t at_least_head(const send_window_ring_t* swnd, uint32_t counter) {
+    return (int32_t)(counter - swnd->head) < 0 ? swnd->head : counter;
+}
+
+void swnd_pop(send_window_ring_t* swnd, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i) {
+        send_window_slot_t* slot = swnd_at(swnd, i);
+
+        if (slot->flags & SWND_SACKED) {
+            swnd->sacked_bytes -= slot->len;
+        }
+        else {
+            deliver(swnd, slot);
+        }
+        if (slot->flags & SWND_LOST) {
+            swnd->lost_bytes -= slot->len;
+        }
+        if (slot->flags & SWND_RETRANS) {
+            swnd->retrans_bytes -= slot->len;
+        }
+    }
+    swnd->head += n;
+    swnd->next_send = at_least_head(swnd, swnd->next_send);
+    swnd->high_sacked = at_least_head(swnd, swnd->high_sacked);
+    swnd->lost_hint = at_least_head(swnd, swnd->lost_hint);
+    swnd->retrans_hint = at_least_head(swnd, swnd->retrans_hint);
+}
+
+void swnd_sent(send_window_ring_t* swnd, send_window_slot_t* slot, int64_t now) {
+    if ((slot->flags & SWND_SENT) && slot->retransmits < UINT8_MAX) {
+        slot->retransmits++;
+    }
+    if ((slot->flags & (SWND_LOST | SWND_RETRANS)) == SWND_LOST) {
+        slot->flags |= SWND_RETRANS;
+        swnd->retrans_bytes += slot->len;
+    }
+    // Nothing in flight: the intervals of the rate samples start now.
+    if (swnd_pipe(swnd) == 0) {
+        swnd->first_sent_time = now;
+        swnd->delivered_time = now;
+    }
+    slot->flags |= SWND_SENT;
+    if (swnd->app_limited != 0) {
+        slot->flags |= SWND_APP_LIMITED;
+    }
+    else {
+        slot->flags &= ~SWND_APP_LIMITED;
+    }
+    slot->send_time = now;
+    slot->delivered = swnd->delivered;
+    slot->delivered_time = swnd->delivered_time;
+    slot->first_sent_time = swnd->first_sent_time;
+}
+
+void swnd_lose(send_window_ring_t* swnd, send_window_slot_t* slot) {
+    uint32_t i = swnd->head +
+        (((uint32_t)(slot - swnd->slots) - swnd->head) & swnd->mask);
+
+    if (!(slot->flags & SWND_SENT) ||
+        (slot->flags & (SWND_SACKED | SWND_LOST | SWND_RETRANS))) {
+        return;
+    }
+    slot->flags |= SWND_LOST;
+    swnd->lost_bytes += slot->len;
+    if ((int32_t)(i - swnd->retrans_hint) < 0) {
+        swnd->retrans_hint = i;
+    }
+}
+
+uint32_t swnd_sack(send_window_ring_t* swnd, uint32_t start, uint32_t end,
+    uint16_t mss) {
+    uint32_t count = swnd_count(swnd);
+    uint32_t i = swnd_find(swnd, start, mss);
+    uint32_t newly = 0;
+
+    if (i == count) {
+        return 0;
+    }
+    // Only segments the block covers entirely are SACKed.
+    if (swnd_at(swnd, i)->seq != start) {
+        i++;
+    }
+    for (; i < count; ++i) {
+        send_window_slot_t* slot = swnd_at(swnd, i);
+
+        if ((int32_t)(end - (slot->seq + slot->len)) < 0 ||
+            !(slot->flags & SWND_SENT)) {
+            break;
+        }
+        if (slot->flags & SWND_SACKED) {
+            continue;
+        }
+        if (slot->flags & SWND_LOST) {
+            swnd->lost_bytes -= slot->len;
+        }
+        if (slot->flags & SWND_RETRANS) {
+            swnd->retrans_bytes -= slot->len;
+        }
+        slot->flags = (slot->flags & ~(SWND_LOST | SWND_RETRANS)) | SWND_SACKED;
+        swnd->sacked_bytes += slot->len;
+        deliver(swnd, slot);
+        newly++;
+        if ((int32_t)(swnd->head + i + 1 - swnd->high_sacked) > 0) {
+            swnd->high_sacked = swnd->head + i + 1;
+        }
+    }
+    return newly;
+}
+
+void swnd_mark_lost(send_window_ring_t* swnd, uint32_t dup_thresh) {
+    uint32_t sacked = 0;
+    uint32_t i = swnd->high_sacked;
+    uint32_t checked = swnd->lost_hint;
+
+    // Walk down from the highest SACKed segment; once `dup_thresh` SACKed
+    // segments were seen, everything below is lost or SACKed, and no later
+    // walk needs to go below this point again.
+    while ((int32_t)(i - swnd->lost_hint) > 0) {
+        send_window_slot_t* slot = &(swnd->slots[--i & swnd->mask]);
+
+        if (slot->flags & SWND_SACKED) {
+            sacked++;
+            continue;
+        }
+        if (sacked < dup_thresh) {
+            continue;
+        }
+        if ((int32_t)(i + 1 - checked) > 0) {
+            checked = i + 1;
+        }
+        if (!(slot->flags & (SWND_LOST | SWND_RETRANS))) {
+            slot->flags |= SWND_LOST;
+            swnd->lost_bytes += slot->len;
+            if ((int32_t)(i - swnd->retrans_hint) < 0) {
+                swnd->retrans_hint = i;
+            }
+        }
+    }
+    swnd->lost_hint = checked;
+}
+
+void swnd_mark_all_lost(send_window_ring_t* swnd) {
+    for (uint32_t i = swnd->head; i != swnd->next_send; ++i) {
+        send_window_slot_t* slot = &(swnd->slots[i & swnd->mask]);
+
+        if (slot->flags & SWND_SACKED) {
+            continue;
+        }
+        if (slot->flags & SWND_RETRANS) {
+            slot->flags &= ~SWND_RETRANS;
+            swnd->retrans_bytes -= slot->len;
+        }
+        if (!(slot->flags & SWND_LOST)) {
+            slot->flags |= SWND_LOST;
+            swnd->lost_bytes += slot->len;
+        }
+    }
+    swnd->lost_hint = swnd->next_send;
+    swnd->retrans_hint = swnd->head;
+}
+
+send_window_slot_t* swnd_next_lost(send_window_ring_t* swnd) {
+    for (; swnd->retrans_hint != swnd->next_send; swnd->retrans_hint++) {
+        send_window_slot_t* slot =
+            &(swnd->slots[swnd->retrans_hint & swnd->mask]);
+
+        if ((slot->flags & (SWND_LOST | SWND_RETRANS)) == SWND_LOST) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+uint32_t swnd_out(const send_window_ring_t* swnd) {
+    send_window_slot_t* last;
+
+    if (swnd->next_send == swnd->head) {
+        return 0;
+    }
+    last = &(swnd->slots[(swnd->next_send - 1) & swnd->mask]);
+    return last->seq + last->len - swnd_front(swnd)->seq;
+}
+
+uint32_t swnd_pipe(const send_window_ring_t* swnd) {
+    return swnd_out(swnd) - swnd->sacked_bytes - swnd->lost_bytes +
+        swnd->retrans_bytes;
+}
+
+void swnd_rate_begin(send_window_ring_t* swnd, int64_t now) {
+    swnd->rs_now = now;
+    swnd->rs_newly = 0;
+}
+
+uint32_t swnd_rate_sample(send_window_ring_t* swnd, swnd_rate_sample_t* rs) {
+    if (swnd->app_limited != 0 && swnd->delivered > swnd->app_limited) {
+        swnd->app_limited = 0;
+    }
+    rs->newly_delivered = swnd->rs_newly;
+    rs->delivered = 0;
+    rs->interval = 0;
+    rs->prior_delivered = swnd->rs_prior_delivered;
+    rs->is_app_limited = swnd->rs_app_limited;
+    if (swnd->rs_newly == 0 || swnd->rs_prior_time == 0) {
+        return swnd->rs_newly;
+    }
+    rs->delivered = swnd->delivered - swnd->rs_prior_delivered;
+    // The slower of the send and ACK rates: ACKs may be compressed, and the
+    // sender may have burst.
+    rs->interval = swnd->rs_send_elapsed > swnd->rs_ack_elapsed ?
+        swnd->rs_send_elapsed : swnd->rs_ack_elapsed;
+    return swnd->rs_newly;
+}
+
+void swnd_app_limited(send_window_ring_t* swnd) {
+    uint64_t mark = swnd->delivered + swnd_pipe(swnd);
+
+    swnd->app_limited = mark != 0 ? mark : 1;
+}
+
+/**
+ * Tells if the segment of a slot holds sequence number `seq`.
+ */
+static int slot_holds(const send_window_slot_t* slot, uint32_t seq) {
+    return seq - slot->seq < slot->len;
+}
+
+uint32_t swnd_find(const send_window_ring_t* swnd, uint32_t seq, uint16_t mss) {
+    uint32_t count = swnd_count(swnd);
+    uint32_t lo = 0, hi = count, i;
+
+    if (count == 0) {
+        return count;
+    }
+    // Full-sized segments: the position follows from the offset.
+    i = (seq - swnd_front(swnd)->seq) / mss;
+    if (i < count && slot_holds(swnd_at(swnd, i), seq)) {
+        return i;
+    }
+    // Otherwise, the last segment with a start at or before `seq`.
+    while (hi - lo > 1) {
+        i = lo + (hi - lo) / 2;
+        if ((int32_t)(seq - swnd_at(swnd, i)->seq) >= 0) {
+            lo = i;
+        }
+        else {
+            hi = i;
+        }
+    }
+    return slot_holds(swnd_at(swnd, lo), seq) ? lo : count;
+}
@@ -18,10 +18,29 @@ from releasing their forks in any public places. */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "foggy_backend.h"
+#include "foggy_function.h"
+#include "foggy_option.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+// Defaults of the per-socket options, set with a NULL socket.
+static int default_udp_offload = 0;
+static int default_io_engine = FOGGY_IO_SYSCALL;
+static int default_sndbuf = SNDBUF_DEFAULT;
+static int default_nonblocking = 0;
+static int default_rcvbuf = RCVBUF_DEFAULT;
+static int default_zerocopy = 0;
+static int default_timestamps = 1;
+static int default_window_scale = 1;
+static int default_pacing_rate = 0;
+static int default_reuseport = 0;
+// NULL until foggy_set_congestion_control() picks one: CC_DEFAULT.
+static const cc_ops_t* default_cc = NULL;
 
 void* foggy_socket(const foggy_socket_type_t socket_type,
     const char* server_port, const char* server_ip) {
@@ -37,22 +56,43 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
         return NULL;
     }
     sock->socket = sockfd;
-    // sock->state = CLOSED;
-    sock->received_buf = NULL;
-    sock->received_len = 0;
-    pthread_mutex_init(&(sock->recv_lock), NULL);
+    if (ring_init(&(sock->recv_ring), default_rcvbuf) < 0) {
+        perror("ERROR allocating receive buffer");
+        close(sockfd);
+        return NULL;
+    }
+    sock->window_update = 0;
 
-    sock->sending_buf = NULL;
-    sock->sending_len = 0;
-    pthread_mutex_init(&(sock->send_lock), NULL);
+    if (ring_init(&(sock->send_ring), default_sndbuf) < 0) {
+        perror("ERROR allocating send buffer");
+        ring_destroy(&(sock->recv_ring));
+        close(sockfd);
+        return NULL;
+    }
+    if (swnd_init(&(sock->send_window)) < 0) {
+        perror("ERROR allocating send window");
+        ring_destroy(&(sock->recv_ring));
+        ring_destroy(&(sock->send_ring));
+        close(sockfd);
+        return NULL;
+    }
+    sock->send_pulled = 0;
+    sock->nonblocking = default_nonblocking;
 
     sock->type = socket_type;
+    sock->is_connected = 0;
     sock->dying = 0;
-    pthread_mutex_init(&(sock->death_lock), NULL);
 
-    // FIXME: Sequence numbers should be randomly initialized. The next expected
-    // sequence number should be initialized according to the SYN packet from the
-    // other side of the connection.
+    // The initial sequence number is random, so that segments of an older
+    // connection between the same ports are unlikely to fit in the window.
+    // The SYN takes it; data starts right after. The next expected sequence
+    // number is taken from the SYN of the other side.
+    uint32_t isn;
+    if (getrandom(&isn, sizeof(isn), 0) != sizeof(isn)) {
+        isn = (uint32_t)get_time_in_ns();
+    }
+    sock->state = socket_type == TCP_LISTENER ? TCP_LISTEN : TCP_SYN_SENT;
+    sock->send_ring_seq = isn + 1;
     sock->window.last_byte_sent = 0;
     sock->window.last_ack_received = 0;
     sock->window.dup_ack_count = 0;
@@ -61,29 +101,43 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
     sock->window.advertised_window = WINDOW_INITIAL_ADVERTISED;
     sock->window.congestion_window = WINDOW_INITIAL_WINDOW_SIZE;
     sock->window.reno_state = RENO_SLOW_START;
-    pthread_mutex_init(&(sock->window.ack_lock), NULL);
+    sock->window.recovery_point = isn;
+    sock->window.sack_seen = 0;
 
     // -------------------------------------------------------------------
     // CORRECTION: Initialisation des variables GBN manquantes et du timer.
     // Ces variables sont ncessaires pour la logique dans foggy_backend.cc.
     // -------------------------------------------------------------------
-    sock->window.send_base = 0;           // Base de la fentre d'envoi
-    sock->window.next_seq_num = 0;        // Prochain numro de squence  utiliser
+    sock->window.send_base = isn;         // Base de la fentre d'envoi : le SYN
+    sock->window.next_seq_num = isn + 1;  // Prochain numro de squence  utiliser
     sock->window.effective_window_size = 0; // Calcule plus tard
     sock->window.retransmit_timeout = 0;  // Timer inactif au dmarrage
+    sock->window.rto = RTO_INITIAL;
+    sock->window.srtt = 0;
+    sock->window.rttvar = 0;
     sock->window.last_send_time.tv_sec = 0;
     sock->window.last_send_time.tv_nsec = 0;
     // -------------------------------------------------------------------
 
-    for (int i = 0; i < RECEIVE_WINDOW_SLOT_SIZE; ++i) {
-        sock->receive_window[i].is_used = 0;
-        sock->receive_window[i].msg = NULL;
-    }
-
-    if (pthread_cond_init(&sock->wait_cond, NULL) != 0) {
-        perror("ERROR condition variable not set\n");
-        return NULL;
+    sock->receive_window_count = 0;
+    sock->receive_window_recent = 0;
+    sock->ts_enabled = default_timestamps;
+    sock->ts_recent = 0;
+    sock->ts_recent_time = 0;
+    // Offer the smallest shift that lets the window cover the whole receive
+    // buffer.
+    sock->ws_enabled = default_window_scale;
+    sock->rcv_wscale = 0;
+    sock->snd_wscale = 0;
+    while (sock->ws_enabled && sock->rcv_wscale < OPT_WSCALE_MAX &&
+        (sock->recv_ring.capacity >> sock->rcv_wscale) > MAX_NETWORK_BUFFER) {
+        sock->rcv_wscale++;
     }
+    sock->cc_request = NULL;
+    cc_init(sock, default_cc != NULL ? default_cc : cc_find(CC_DEFAULT));
+    sock->max_pacing_rate = default_pacing_rate;
+    sock->pacing_next = 0;
+    sock->pacing_wait = 0;
 
     // ... (Reste de la fonction inchange) ...
 
@@ -117,9 +171,17 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
         conn.sin_addr.s_addr = htonl(INADDR_ANY);
         conn.sin_port = htons(portno);
 
-        optval = 1;
-        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval,
-            sizeof(int));
+        // Several listeners may share the port: the kernel gives each new
+        // flow to one of those not connected yet (and so to one backend
+        // shard), and a connected one the datagrams of its peer. Otherwise
+        // the port is ours alone; for UDP, SO_REUSEADDR would share it too.
+        if (default_reuseport) {
+            optval = 1;
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR,
+                (const void*)&optval, sizeof(int));
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
+                (const void*)&optval, sizeof(int));
+        }
         if (bind(sockfd, (struct sockaddr*)&conn, sizeof(conn)) < 0) {
             perror("ERROR on binding");
             return NULL;
@@ -134,26 +196,32 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
     getsockname(sockfd, (struct sockaddr*)&my_addr, &len);
     sock->my_port = ntohs(my_addr.sin_port);
 
-    pthread_create(&(sock->thread_id), NULL, begin_backend, (void*)sock);
+    set_udp_offload(sock, default_udp_offload);
+    sock->io_engine = default_io_engine;
+    sock->zc_next_id = 0;
+    sock->zc_hdrs = NULL;
+    sock->zc_hdr_head = 0;
+    sock->zc_hdr_tail = 0;
+    set_zerocopy(sock, default_zerocopy);
+
+    backend_register(sock);
     return (void*)sock;
 }
 
 int foggy_close(void* in_sock) {
     struct foggy_socket_t* sock = (struct foggy_socket_t*)in_sock;
-    while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
-    }
-    sock->dying = 1;
-    pthread_mutex_unlock(&(sock->death_lock));
+    __atomic_store_n(&(sock->dying), 1, __ATOMIC_RELEASE);
+    notify_backend(sock);
 
-    pthread_join(sock->thread_id, NULL);
+    // Wait for the backend to flush the connection and release the socket.
+    while (!__atomic_load_n(&(sock->closed), __ATOMIC_ACQUIRE)) {
+        futex_wait(&(sock->closed), 0);
+    }
 
     if (sock != NULL) {
-        if (sock->received_buf != NULL) {
-            free(sock->received_buf);
-        }
-        if (sock->sending_buf != NULL) {
-            free(sock->sending_buf);
-        }
+        ring_destroy(&(sock->recv_ring));
+        ring_destroy(&(sock->send_ring));
+        swnd_destroy(&(sock->send_window));
     }
     else {
         perror("ERROR null socket\n");
@@ -162,58 +230,220 @@ int foggy_close(void* in_sock) {
     return close(sock->socket);
 }
 
+/**
+ * Called once the application consumed received bytes. The peer only learns
+ * about the room they made from our next ACK: if the window was small and is
+ * now large, have the backend send one.
+ *
+ * @param sock The socket.
+ * @param space The free room of the receive buffer before consuming.
+ * @param len The number of bytes consumed.
+ */
+static void reopen_receive_window(foggy_socket_t* sock, uint32_t space,
+    uint32_t len) {
+    uint8_t shift = __atomic_load_n(&(sock->rcv_wscale), __ATOMIC_RELAXED);
+    uint32_t threshold =
+        MIN(sock->recv_ring.capacity, (uint32_t)MAX_NETWORK_BUFFER << shift) / 2;
+
+    if (space < threshold && space + len >= threshold) {
+        __atomic_store_n(&(sock->window_update), 1, __ATOMIC_RELEASE);
+        notify_backend(sock);
+    }
+}
+
 int foggy_read(void* in_sock, void* buf, int length) {
     struct foggy_socket_t* sock = (struct foggy_socket_t*)in_sock;
-    uint8_t* new_buf;
-    int read_len = 0;
+    uint32_t space;
+    int read_len;
 
     if (length < 0) {
         perror("ERROR negative length");
         return EXIT_ERROR;
     }
 
-    while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+    ring_wait_data(&(sock->recv_ring));
+    space = ring_space(&(sock->recv_ring));
+    read_len = ring_read(&(sock->recv_ring), (uint8_t*)buf, length);
+    reopen_receive_window(sock, space, read_len);
+    return read_len;
+}
+
+int foggy_read_zc(void* in_sock, const void** data, int length) {
+    struct foggy_socket_t* sock = (struct foggy_socket_t*)in_sock;
+    uint8_t* view;
+    uint32_t len;
+
+    if (length < 0) {
+        perror("ERROR negative length");
+        return EXIT_ERROR;
     }
 
-    while (sock->received_len == 0) {
-        pthread_cond_wait(&(sock->wait_cond), &(sock->recv_lock));
+    ring_wait_data(&(sock->recv_ring));
+    len = ring_peek(&(sock->recv_ring), 0, &view);
+    *data = view;
+    return MIN(len, (uint32_t)length);
+}
+
+int foggy_release(void* in_sock, int length) {
+    struct foggy_socket_t* sock = (struct foggy_socket_t*)in_sock;
+    uint32_t space;
+
+    if (length < 0 || (uint32_t)length > ring_used(&(sock->recv_ring))) {
+        perror("ERROR releasing more than received");
+        return EXIT_ERROR;
     }
-    if (sock->received_len > 0) {
-        if (sock->received_len > length)
-            read_len = length;
-        else
-            read_len = sock->received_len;
 
-        memcpy(buf, sock->received_buf, read_len);
-        if (read_len < sock->received_len) {
-            new_buf = (uint8_t*)malloc(sock->received_len - read_len);
-            memcpy(new_buf, sock->received_buf + read_len,
-                sock->received_len - read_len);
-            free(sock->received_buf);
-            sock->received_len -= read_len;
-            sock->received_buf = new_buf;
+    space = ring_space(&(sock->recv_ring));
+    ring_consume(&(sock->recv_ring), length);
+    reopen_receive_window(sock, space, length);
+    return EXIT_SUCCESS;
+}
+
+int foggy_write(void* in_sock, const void* buf, int length) {
+    struct foggy_socket_t* sock = (struct foggy_socket_t*)in_sock;
+    const uint8_t* data = (const uint8_t*)buf;
+    int written = 0;
+    uint32_t n;
+
+    if (length < 0) {
+        perror("ERROR negative length");
+        return EXIT_ERROR;
+    }
+
+    while (written < length) {
+        n = ring_write(&(sock->send_ring), data + written, length - written);
+        if (n > 0) {
+            written += n;
+            // Only wake the backend if it had segmented everything written
+            // before: otherwise it still has data to send and will see ours.
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&(sock->send_pulled), __ATOMIC_ACQUIRE) ==
+                sock->send_ring.tail - n) {
+                notify_backend(sock);
+            }
+            continue;
         }
-        else {
-            free(sock->received_buf);
-            sock->received_buf = NULL;
-            sock->received_len = 0;
+        if (sock->nonblocking) {
+            break;
         }
+
+        // The ring is full: wait for the backend to send some of it.
+        ring_wait_space(&(sock->send_ring));
     }
-    pthread_mutex_unlock(&(sock->recv_lock));
-    return read_len;
+    return written;
 }
 
-int foggy_write(void* in_sock, const void* buf, int length) {
-    struct foggy_socket_t* sock = (struct foggy_socket_t*)in_sock;
-    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+int foggy_setsockopt(void* in_sock, foggy_option_t option, int value) {
+    switch (option) {
+    case FOGGY_OPT_BACKEND_THREADS:
+        if (in_sock != NULL) {
+            return EXIT_ERROR;
+        }
+        return backend_set_num_threads(value);
+
+    case FOGGY_OPT_UDP_OFFLOAD:
+        if (in_sock != NULL) {
+            return EXIT_ERROR;
+        }
+        default_udp_offload = value;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_IO_ENGINE:
+        if (in_sock != NULL ||
+            (value != FOGGY_IO_SYSCALL && value != FOGGY_IO_URING)) {
+            return EXIT_ERROR;
+        }
+        default_io_engine = value;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_SNDBUF:
+        if (in_sock != NULL || value <= 0 ||
+            (uint32_t)value > RING_MAX_CAPACITY) {
+            return EXIT_ERROR;
+        }
+        default_sndbuf = value;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_RCVBUF:
+        // Smaller than a segment, nothing could ever be received.
+        if (in_sock != NULL || value < (int)MSS ||
+            (uint32_t)value > RING_MAX_CAPACITY) {
+            return EXIT_ERROR;
+        }
+        default_rcvbuf = value;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_ZEROCOPY:
+        if (in_sock != NULL) {
+            return EXIT_ERROR;
+        }
+        default_zerocopy = value;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_TIMESTAMPS:
+        if (in_sock != NULL) {
+            return EXIT_ERROR;
+        }
+        default_timestamps = value != 0;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_WINDOW_SCALE:
+        if (in_sock != NULL) {
+            return EXIT_ERROR;
+        }
+        default_window_scale = value != 0;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_NONBLOCK:
+        if (in_sock == NULL) {
+            default_nonblocking = value != 0;
+        }
+        else {
+            ((foggy_socket_t*)in_sock)->nonblocking = value != 0;
+        }
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_REUSEPORT:
+        if (in_sock != NULL) {
+            return EXIT_ERROR;
+        }
+        default_reuseport = value != 0;
+        return EXIT_SUCCESS;
+
+    case FOGGY_OPT_PACING_RATE:
+        if (value < 0) {
+            return EXIT_ERROR;
+        }
+        if (in_sock == NULL) {
+            default_pacing_rate = value;
+        }
+        else {
+            // Read by the backend at its next transmission.
+            __atomic_store_n(&(((foggy_socket_t*)in_sock)->max_pacing_rate),
+                (uint32_t)value, __ATOMIC_RELAXED);
+        }
+        return EXIT_SUCCESS;
+
+    default:
+        perror("ERROR unknown option");
+        return EXIT_ERROR;
     }
-    if (sock->sending_buf == NULL)
-        sock->sending_buf = (uint8_t*)malloc(length);
-    else
-        sock->sending_buf = (uint8_t*)realloc(sock->sending_buf, length + sock->sending_len);
-    memcpy(sock->sending_buf + sock->sending_len, buf, length);
-    sock->sending_len += length;
+}
+
+int foggy_set_congestion_control(void* in_sock, const char* name) {
+    const cc_ops_t* cc = name != NULL ? cc_find(name) : NULL;
 
-    pthread_mutex_unlock(&(sock->send_lock));
+    if (cc == NULL) {
+        perror("ERROR unknown congestion control");
+        return EXIT_ERROR;
+    }
+    if (in_sock == NULL) {
+        default_cc = cc;
+        return EXIT_SUCCESS;
+    }
+    // The backend owns the window: it makes the switch.
+    __atomic_store_n(&(((foggy_socket_t*)in_sock)->cc_request), cc,
+        __ATOMIC_RELEASE);
+    notify_backend((foggy_socket_t*)in_sock);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,214 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120)
+course taught at Hong Kong University of Science and Technology.
+
+No part of the project may be copied and/or distributed without
+the express permission of the course staff. Everyone is prohibited
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the small io_uring wrapper used by the io_uring I/O
+ * engine of the backend: ring setup, submission, completion and the provided
+ * buffer ring used by multishot receives.
+ */
+
+#include "foggy_uring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+        NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg,
+    unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t* ring, unsigned entries, unsigned buf_count,
+    unsigned buf_size) {
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    size_t ring_bytes;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = sys_io_uring_setup(entries, &params);
+    if (ring->ring_fd < 0) {
+        return -1;
+    }
+
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_len > ring->sq_map_len) {
+            ring->sq_map_len = ring->cq_map_len;
+        }
+        ring->cq_map_len = ring->sq_map_len;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->ring_fd);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else {
+        ring->cq_ptr = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_map_len);
+            close(ring->ring_fd);
+            return -1;
+        }
+    }
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL,
+        params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        uring_exit(ring);
+        return -1;
+    }
+
+    uint8_t* sq = (uint8_t*)ring->sq_ptr;
+    uint8_t* cq = (uint8_t*)ring->cq_ptr;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Provided buffer ring: the kernel picks a buffer for every datagram of
+    // a multishot receive, and we give it back once the datagram is handled.
+    ring_bytes = buf_count * sizeof(struct io_uring_buf);
+    ring->buf_ring = (struct io_uring_buf_ring*)mmap(NULL, ring_bytes,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->bufs = (uint8_t*)malloc((size_t)buf_count * buf_size);
+    if (ring->buf_ring == MAP_FAILED || ring->bufs == NULL) {
+        if (ring->buf_ring == MAP_FAILED) {
+            ring->buf_ring = NULL;
+        }
+        uring_exit(ring);
+        return -1;
+    }
+    ring->buf_count = buf_count;
+    ring->buf_size = buf_size;
+    ring->buf_group = 0;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = ring->buf_group;
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg,
+        1) < 0) {
+        uring_exit(ring);
+        return -1;
+    }
+    for (unsigned i = 0; i < buf_count; ++i) {
+        uring_recycle_buf(ring, i);
+    }
+    return 0;
+}
+
+void uring_exit(uring_t* ring) {
+    if (ring->buf_ring != NULL) {
+        munmap(ring->buf_ring, ring->buf_count * sizeof(struct io_uring_buf));
+    }
+    free(ring->bufs);
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_map_len);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_map_len);
+    }
+    close(ring->ring_fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->sq_pending;
+    struct io_uring_sqe* sqe;
+
+    if (tail - head >= ring->sq_entries) {
+        uring_submit(ring, 0);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        tail = *ring->sq_tail + ring->sq_pending;
+        if (tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    sqe = &(ring->sqes[tail & ring->sq_mask]);
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+    ring->sq_pending++;
+    return sqe;
+}
+
+int uring_submit(uring_t* ring, unsigned wait_nr) {
+    unsigned to_submit = ring->sq_pending;
+    int ret;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + to_submit,
+        __ATOMIC_RELEASE);
+    ring->sq_pending = 0;
+    do {
+        ret = sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr,
+            wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring) {
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &(ring->cqes[head & ring->cq_mask]);
+}
+
+void uring_cqe_seen(uring_t* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+uint8_t* uring_buf(uring_t* ring, uint16_t bid) {
+    return ring->bufs + (size_t)bid * ring->buf_size;
+}
+
+void uring_recycle_buf(uring_t* ring, uint16_t bid) {
+    // Index the entries through a plain pointer: in C++, the flexible array
+    // of `io_uring_buf_ring` does not start at offset 0 as the kernel expects.
+    struct io_uring_buf* buf = (struct io_uring_buf*)ring->buf_ring +
+        (ring->buf_tail & (ring->buf_count - 1));
+
+    buf->addr = (uint64_t)(uintptr_t)uring_buf(ring, bid);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+    ring->buf_tail++;
+    __atomic_store_n(&(ring->buf_ring->tail), ring->buf_tail, __ATOMIC_RELEASE);
+}
@@ -12,7 +12,6 @@
  /*modified by the 6th group*/
 #include <fstream>
 #include <iostream>
-#include <cstring>
 using namespace std;
 
 #include "foggy_tcp.h"
@@ -51,36 +50,26 @@ int main(int argc, const char* argv[]) {
     return -1;
   }
 
-  char buf[BUF_SIZE + sizeof(struct timespec)];
-  bool first_packet = true;
-  
+  /* The sender starts with its start time */
+  int bytes_read = foggy_read(sock, &start_time, sizeof(start_time));
+  if (bytes_read < (int)sizeof(start_time)) {
+    cerr << "Error: First packet too small to contain timestamp\n";
+    return -1;
+  }
+
   while (true) {
-    /* Read data from the socket into the buffer. The amount of data read is
-     * stored in bytes_read. If bytes_read is less than or equal to 0, it means
-     * we've reached the end of transmission or an error occurred. We break out
-     * of the loop */
-    int bytes_read = foggy_read(sock, buf, BUF_SIZE + sizeof(struct timespec));
+    /* Borrow the received data in place rather than copying it into a
+     * buffer: it is written to the file straight from the socket's receive
+     * buffer, then released so that the sender can send more. If bytes_read
+     * is less than or equal to 0, it means we've reached the end of
+     * transmission or an error occurred. We break out of the loop */
+    const void* data;
+    bytes_read = foggy_read_zc(sock, &data, BUF_SIZE);
     if (bytes_read <= 0)
       break;
 
-    if (first_packet) {
-      /* Extract start time from first packet */
-      if (bytes_read < sizeof(start_time)) {
-        cerr << "Error: First packet too small to contain timestamp\n";
-        return -1;
-      }
-      
-      memcpy(&start_time, buf, sizeof(start_time));
-      
-      /* Write the actual data (excluding timestamp) to file */
-      int actual_data_size = bytes_read - sizeof(start_time);
-      if (actual_data_size > 0) {
-        ofs.write(buf + sizeof(start_time), actual_data_size);
-      }
-      first_packet = false;
-    } else {
-      ofs.write((char*)buf, bytes_read);
-    }
+    ofs.write((const char*)data, bytes_read);
+    foggy_release(sock, bytes_read);
   }
 
   struct timespec end_time;